@@ -0,0 +1,216 @@
+/*!
+@file
+@brief Measures parsing speed and memory on a set of VCD files.
+@details Each file is parsed in three modes, each in a child process so
+peak RSS is per mode:
+- store: parse_file, keeping every value in a VCDFile.
+- stream: parse_stream with a visitor that only counts value changes.
+- printer: the transaction printer of vcd-parse, output discarded.
+
+One JSON object per file and mode is written to stdout, see print_result.
+
+Usage: vcd-bench [--tag=T] [--config=NAME] [--threads=N] file.vcd...
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "VCDTypes.hpp"
+
+//! main() of vcd-parse, built from main.cpp under this name.
+int vcd_parse_main(int argc, char ** argv);
+
+//! Allocations made through operator new, and their total size.
+static std::atomic<uint64_t> allocations(0);
+static std::atomic<uint64_t> allocated_bytes(0);
+
+void * operator new(size_t size) {
+    allocations++;
+    allocated_bytes += size;
+    void * p = std::malloc(size ? size : 1);
+    if(!p)
+        throw std::bad_alloc();
+    return p;
+}
+void * operator new[](size_t size) {
+    return operator new(size);
+}
+void * operator new(size_t size, const std::nothrow_t &) noexcept {
+    allocations++;
+    allocated_bytes += size;
+    return std::malloc(size ? size : 1);
+}
+void * operator new[](size_t size, const std::nothrow_t & tag) noexcept {
+    return operator new(size, tag);
+}
+void operator delete(void * p) noexcept {
+    std::free(p);
+}
+void operator delete[](void * p) noexcept {
+    std::free(p);
+}
+void operator delete(void * p, size_t) noexcept {
+    std::free(p);
+}
+void operator delete[](void * p, size_t) noexcept {
+    std::free(p);
+}
+
+//! What a child process reports back.
+typedef struct {
+    int      ok;
+    double   seconds;
+    uint64_t changes;
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+} BenchResult;
+
+//! Counts value changes and nothing else.
+class CountingVisitor : public VCDVisitor {
+public:
+    uint64_t changes;
+    CountingVisitor() : changes(0) {}
+    void on_value_change(VCDSignalHandle handle, VCDTime time,
+                         const VCDValue & value) {
+        this->changes++;
+    }
+};
+
+static const char * MODES[] = {"store", "stream", "printer"};
+
+//! Parse path in the given mode, in the calling process.
+static BenchResult run_mode(const char * mode, const char * path,
+                            unsigned threads) {
+    BenchResult r;
+    std::memset(&r, 0, sizeof(r));
+    allocations     = 0;
+    allocated_bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    if(std::strcmp(mode, "store") == 0) {
+        VCDFileParser parser;
+        parser.threads = threads;
+        VCDFile * file = parser.parse_file(path);
+        if(file) {
+            for(size_t h = 0; h < file->get_handle_count(); h++)
+                r.changes += file->get_signal_values(h)->size();
+            r.ok = 1;
+        }
+        delete file;
+    } else if(std::strcmp(mode, "stream") == 0) {
+        VCDFileParser   parser;
+        CountingVisitor counter;
+        r.ok      = parser.parse_stream(path, counter);
+        r.changes = counter.changes;
+    } else {
+        // The printer writes a lot, send it where it costs nothing.
+        int null = open("/dev/null", O_WRONLY);
+        std::fflush(stdout);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+        char   name[] = "vcd-parse";
+        char * argv[] = {name, (char *)path, nullptr};
+        r.ok = vcd_parse_main(2, argv) == 0;
+        std::fflush(stdout);
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    r.seconds         = elapsed.count();
+    r.allocations     = allocations;
+    r.allocated_bytes = allocated_bytes;
+    return r;
+}
+
+/*!
+@brief Run run_mode in a child process.
+@param peak_rss Set to the peak resident set of the child in KB.
+*/
+static BenchResult run_child(const char * mode, const char * path,
+                             unsigned threads, long & peak_rss) {
+    BenchResult r;
+    std::memset(&r, 0, sizeof(r));
+    peak_rss = 0;
+    int fds[2];
+    if(pipe(fds) != 0)
+        return r;
+    std::fflush(stdout);
+    pid_t pid = fork();
+    if(pid == 0) {
+        close(fds[0]);
+        BenchResult child = run_mode(mode, path, threads);
+        ssize_t n = write(fds[1], &child, sizeof(child));
+        _exit(n == sizeof(child) ? 0 : 1);
+    }
+    close(fds[1]);
+    if(pid > 0 && read(fds[0], &r, sizeof(r)) != sizeof(r))
+        std::memset(&r, 0, sizeof(r));
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    if(pid > 0 && wait4(pid, &status, 0, &usage) == pid)
+        peak_rss = usage.ru_maxrss;
+    return r;
+}
+
+//! Write one result as a line of JSON.
+static void print_result(const char * tag, const char * config,
+                         const char * mode, const char * path,
+                         uint64_t bytes, uint64_t changes,
+                         const BenchResult & r, long peak_rss) {
+    double seconds = r.seconds > 0 ? r.seconds : 1e-9;
+    std::printf("{\"tag\": \"%s\", \"config\": \"%s\", \"mode\": \"%s\", "
+                "\"file\": \"%s\", \"ok\": %s, \"bytes\": %llu, "
+                "\"seconds\": %.6f, \"mb_per_s\": %.2f, \"changes\": %llu, "
+                "\"changes_per_s\": %.0f, \"allocations\": %llu, "
+                "\"allocated_bytes\": %llu, \"peak_rss_kb\": %ld}\n",
+                tag, config, mode, path, r.ok ? "true" : "false",
+                (unsigned long long)bytes, r.seconds, bytes / 1e6 / seconds,
+                (unsigned long long)changes, changes / seconds,
+                (unsigned long long)r.allocations,
+                (unsigned long long)r.allocated_bytes, peak_rss);
+    std::fflush(stdout);
+}
+
+int main(int argc, char ** argv) {
+    const char * tag     = "";
+    const char * config  = nullptr;
+    unsigned     threads = 1;
+    int          status  = 0;
+    for(int i = 1; i < argc; i++) {
+        if(std::strncmp(argv[i], "--tag=", 6) == 0) {
+            tag = argv[i] + 6;
+        } else if(std::strncmp(argv[i], "--config=", 9) == 0) {
+            config = argv[i] + 9;
+        } else if(std::strncmp(argv[i], "--threads=", 10) == 0) {
+            threads = std::atoi(argv[i] + 10);
+        } else {
+            struct stat st;
+            if(stat(argv[i], &st) != 0) {
+                std::perror(argv[i]);
+                status = 1;
+                continue;
+            }
+            // The store mode counts the changes for the printer mode.
+            uint64_t changes = 0;
+            for(const char * mode : MODES) {
+                long peak_rss;
+                BenchResult r = run_child(mode, argv[i], threads, peak_rss);
+                if(std::strcmp(mode, "printer") != 0)
+                    changes = r.changes;
+                if(!r.ok)
+                    status = 1;
+                print_result(tag, config ? config : argv[i], mode, argv[i],
+                             st.st_size, changes, r, peak_rss);
+            }
+        }
+    }
+    return status;
+}
@@ -0,0 +1,242 @@
+/*!
+@file
+@brief Deterministic generator of synthetic VCD files for benchmarking.
+@details The same options and seed always produce the same file. Besides
+plain signals, each generated method has __ENA and __RDY wires and a $data
+parameter, so the transaction printer of vcd-parse has work to do.
+
+Usage: vcd-generate [options] output.vcd
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+//! Options of the generated file.
+typedef struct {
+    unsigned signals;   //!< Plain signals, besides CLK and method signals.
+    unsigned width;     //!< Bits in each plain signal and method parameter.
+    double   density;   //!< Chance of a signal changing in a timestep.
+    unsigned depth;     //!< Levels of module scopes below TOP.
+    unsigned idlen;     //!< Minimum length of identifier codes.
+    unsigned steps;     //!< Number of timesteps after #0.
+    unsigned methods;   //!< Number of ENA/RDY methods.
+    uint64_t seed;      //!< Seed of the random number generator.
+} GenOptions;
+
+//! splitmix64, so output does not depend on the standard library.
+class GenRandom {
+    uint64_t state;
+public:
+    GenRandom(uint64_t seed) : state(seed) {}
+    uint64_t next() {
+        uint64_t z = (this->state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+    //! True with the given probability.
+    bool chance(double p) {
+        return (this->next() >> 11) * (1.0 / 9007199254740992.0) < p;
+    }
+};
+
+//! A declared signal and its current value.
+typedef struct {
+    std::string id;
+    unsigned    width;
+    uint64_t    value;  //!< Low bits of the value, the rest are random.
+} GenSignal;
+
+//! Indices of the signals of a method.
+typedef struct {
+    size_t ena;
+    size_t rdy;
+    size_t data;
+} GenMethod;
+
+//! Identifier code number n, first character least significant.
+static std::string make_idcode(uint64_t n) {
+    std::string id;
+    do {
+        id += (char)('!' + n % 94);
+        n /= 94;
+    } while(n);
+    return id;
+}
+
+//! Write a value change of signal s.
+static void put_value(FILE * out, GenRandom & rng, const GenSignal & s) {
+    if(s.width == 1) {
+        std::fprintf(out, "%c%s\n", (s.value & 1) ? '1' : '0', s.id.c_str());
+        return;
+    }
+    std::string bits(s.width, '0');
+    for(unsigned i = 0; i < s.width; i++) {
+        uint64_t word = i < 64 ? s.value : rng.next();
+        bits[s.width - 1 - i] = ((word >> (i % 64)) & 1) ? '1' : '0';
+    }
+    std::fprintf(out, "b%s %s\n", bits.c_str(), s.id.c_str());
+}
+
+static bool parse_option(const char * arg, const char * name, double & value) {
+    size_t len = std::strlen(name);
+    if(std::strncmp(arg, name, len) != 0 || arg[len] != '=')
+        return false;
+    value = std::atof(arg + len + 1);
+    return true;
+}
+
+int main(int argc, char ** argv) {
+    GenOptions o = {1000, 1, 0.05, 4, 1, 10000, 50, 1};
+    const char * path = nullptr;
+    for(int i = 1; i < argc; i++) {
+        double v;
+        if(parse_option(argv[i], "--signals", v))      o.signals = v;
+        else if(parse_option(argv[i], "--width", v))   o.width = v;
+        else if(parse_option(argv[i], "--density", v)) o.density = v;
+        else if(parse_option(argv[i], "--depth", v))   o.depth = v;
+        else if(parse_option(argv[i], "--idlen", v))   o.idlen = v;
+        else if(parse_option(argv[i], "--steps", v))   o.steps = v;
+        else if(parse_option(argv[i], "--methods", v)) o.methods = v;
+        else if(parse_option(argv[i], "--seed", v))    o.seed = v;
+        else if(argv[i][0] != '-' && !path)            path = argv[i];
+        else {
+            std::fprintf(stderr, "usage: %s [--signals=N] [--width=N] "
+                "[--density=P] [--depth=N] [--idlen=N] [--steps=N] "
+                "[--methods=N] [--seed=N] output.vcd\n", argv[0]);
+            return 1;
+        }
+    }
+    if(!path || o.width == 0 || o.idlen == 0 || o.idlen > 9) {
+        std::fprintf(stderr, "%s: need an output path, a width and an "
+                     "idlen of 1 to 9\n", argv[0]);
+        return 1;
+    }
+    FILE * out = std::fopen(path, "w");
+    if(!out) {
+        std::perror(path);
+        return 1;
+    }
+    static char buffer[1 << 20];
+    std::setvbuf(out, buffer, _IOFBF, sizeof(buffer));
+
+    GenRandom rng(o.seed);
+    // The first code of idlen characters.
+    uint64_t  next_id = o.idlen > 1 ? 1 : 0;
+    for(unsigned i = 1; i < o.idlen; i++)
+        next_id *= 94;
+    std::vector<GenSignal> signals;
+    std::vector<size_t>    plains;
+    std::vector<GenMethod> methods;
+    auto declare = [&](const char * type, unsigned width,
+                       const std::string & name) -> size_t {
+        GenSignal s = {make_idcode(next_id++), width, 0};
+        std::fprintf(out, "$var %s %u %s %s $end\n", type, width,
+                     s.id.c_str(), name.c_str());
+        signals.push_back(s);
+        return signals.size() - 1;
+    };
+
+    std::fprintf(out, "$date today $end\n$version vcd-generate $end\n"
+                 "$timescale 1ns $end\n$scope module TOP $end\n");
+    declare("wire", 1, "CLK");
+    // Spread signals and methods over leaf modules of a tree whose fanout
+    // gives roughly 32 signals per leaf.
+    unsigned total  = o.signals + 3 * o.methods;
+    unsigned leaves = total / 32 + 1;
+    unsigned fanout = 2;
+    if(o.depth > 0) {
+        while(true) {
+            unsigned long long n = 1;
+            for(unsigned d = 0; d < o.depth && n < leaves; d++)
+                n *= fanout;
+            if(n >= leaves)
+                break;
+            fanout++;
+        }
+    }
+    unsigned leaf = 0, plain = 0, method = 0;
+    unsigned per_leaf = total / leaves + 1;
+    std::vector<unsigned> scope(o.depth, 0), open_scope;
+    while(plain < o.signals || method < o.methods) {
+        // Leaf number leaf, written in base fanout, names the scopes. Only
+        // the scopes that differ from the previous leaf are reopened.
+        unsigned n = leaf++;
+        for(unsigned d = o.depth; d-- > 0; n /= fanout)
+            scope[d] = n % fanout;
+        size_t common = 0;
+        while(common < open_scope.size() &&
+              open_scope[common] == scope[common])
+            common++;
+        for(size_t d = common; d < open_scope.size(); d++)
+            std::fprintf(out, "$upscope $end\n");
+        for(size_t d = common; d < scope.size(); d++)
+            std::fprintf(out, "$scope module l%zu_%u $end\n", d, scope[d]);
+        open_scope = scope;
+        for(unsigned k = 0; k < per_leaf; k++) {
+            if(method < o.methods && (k % 4 == 0 || plain >= o.signals)) {
+                std::string name = "m" + std::to_string(method++);
+                GenMethod m;
+                m.ena  = declare("wire", 1, name + "__ENA");
+                m.rdy  = declare("wire", 1, name + "__RDY");
+                m.data = declare("wire", o.width, name + "$data");
+                methods.push_back(m);
+                k += 2;
+            } else if(plain < o.signals) {
+                plains.push_back(declare("wire", o.width,
+                                         "s" + std::to_string(plain++)));
+            }
+        }
+    }
+    for(size_t d = 0; d < open_scope.size(); d++)
+        std::fprintf(out, "$upscope $end\n");
+    std::fprintf(out, "$upscope $end\n$enddefinitions $end\n");
+
+    std::fprintf(out, "#0\n$dumpvars\n");
+    for(GenSignal & s : signals) {
+        s.value = 0;
+        put_value(out, rng, s);
+    }
+    std::fprintf(out, "$end\n");
+
+    for(unsigned t = 1; t <= o.steps; t++) {
+        std::fprintf(out, "#%u\n", t);
+        GenSignal & clk = signals[0];
+        clk.value ^= 1;
+        put_value(out, rng, clk);
+        for(size_t i : plains) {
+            if(!rng.chance(o.density))
+                continue;
+            GenSignal & s = signals[i];
+            s.value = s.width == 1 ? s.value ^ 1 : rng.next();
+            put_value(out, rng, s);
+        }
+        // An ENA pulse lasts one timestep and carries new data, it is only
+        // raised while RDY is high.
+        for(const GenMethod & m : methods) {
+            GenSignal & ena = signals[m.ena];
+            GenSignal & rdy = signals[m.rdy];
+            if(ena.value) {
+                ena.value = 0;
+                put_value(out, rng, ena);
+            } else if(rdy.value && rng.chance(o.density)) {
+                ena.value = 1;
+                put_value(out, rng, ena);
+                signals[m.data].value = rng.next();
+                put_value(out, rng, signals[m.data]);
+            }
+            if(rng.chance(o.density)) {
+                rdy.value ^= 1;
+                put_value(out, rng, rdy);
+            }
+        }
+    }
+    if(std::fclose(out) != 0) {
+        std::perror(path);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,447 @@
+/*!
+@file
+@brief Binary cache files of parsed traces.
+@details A cache file is laid out as
+
+    VCDCacheHeader
+    declarations        date, version, timescale, scopes and signals
+    timestamps          time_count VCDTimeList::encode differences from 0
+    column table        VCDCacheColumn[handle_count]
+    columns             per handle: differences between the times of the
+                        values, VCDValue[count], planes
+
+Everything is in the byte order and layout of the machine that wrote it,
+caches whose VCDValue size differs are rejected. Every section starts on an
+8 byte boundary.
+The VCDValue records are stored as they are in memory, wide vectors refer
+to their planes by an offset from the record, so the columns can be used
+straight from the mapped file.
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "VCDTypes.hpp"
+
+//! Identifies a cache file.
+static const char CACHE_MAGIC[8] = {'V', 'C', 'D', 'C', 'A', 'C', 'H', 'E'};
+//! Bumped whenever the layout changes.
+static const uint32_t CACHE_VERSION = 3;
+
+//! Start of a cache file.
+typedef struct {
+    char     magic[8];        //!< CACHE_MAGIC.
+    uint32_t version;         //!< CACHE_VERSION.
+    uint32_t value_size;      //!< sizeof(VCDValue) of the writer.
+    uint64_t source_size;     //!< Size of the VCD file.
+    int64_t  source_mtime;    //!< Modification time of the VCD file, seconds.
+    int64_t  source_mtime_ns; //!< Nanoseconds part of source_mtime.
+    uint64_t decl_offset;     //!< Start of the declarations.
+    uint64_t decl_size;       //!< Bytes of declarations.
+    uint64_t times_offset;    //!< Start of the timestamps.
+    uint64_t times_size;      //!< Bytes of timestamps.
+    uint64_t time_count;      //!< Number of timestamps.
+    uint64_t columns_offset;  //!< Start of the column table.
+    uint64_t handle_count;    //!< Entries in the column table.
+} VCDCacheHeader;
+
+//! Where the values of one handle are stored.
+typedef struct {
+    uint64_t count;           //!< Number of values.
+    VCDTime  first;           //!< Time of the first value.
+    VCDTime  last;            //!< Time of the last value.
+    uint64_t times_offset;    //!< Start of the differences between times.
+    uint64_t times_size;      //!< Bytes of differences.
+    uint64_t values_offset;   //!< Start of VCDValue[count].
+} VCDCacheColumn;
+
+//! Largest block handed to VCDSignalValues when loading, small enough for
+//! its differences to be counted in 32 bits.
+static const uint64_t CACHE_BLOCK = 1 << 24;
+
+//! Append the difference from prev to time to out.
+static void put_delta(std::vector<uint8_t> & out, VCDTime prev, VCDTime time) {
+    uint8_t buffer[VCDTimeList::MAX_DELTA];
+    out.insert(out.end(), buffer, VCDTimeList::encode(buffer, prev, time));
+}
+
+//! VCDTimeList::decode, returning false instead of reading past end.
+static bool get_delta(const uint8_t *& p, const uint8_t * end,
+                      VCDTime & time) {
+    const uint8_t * q = p;
+    while(q < end && *q >= 0x80)
+        q++;
+    if(q == end)
+        return false;
+    time = VCDTimeList::decode(p, time);
+    return true;
+}
+
+//! True if a value record read from a cache is well formed and refers to
+//! no planes outside the size bytes at map.
+static bool valid_record(const VCDValue & value, const char * map,
+                         uint64_t size) {
+    if(!value.well_formed())
+        return false;
+    return value.get_type() != VCD_VECTOR ||
+           value.get_value_vector()->planes_within(map, size);
+}
+
+//! Append an integer to a declarations buffer.
+static void put_u32(std::string & out, uint32_t v) {
+    out.append((const char *)&v, sizeof(v));
+}
+
+//! Append a length prefixed string to a declarations buffer.
+static void put_str(std::string & out, const std::string & s) {
+    put_u32(out, s.size());
+    out.append(s);
+}
+
+//! Reads back what put_u32 and put_str wrote, checking the bounds.
+typedef struct {
+    const char * p;
+    const char * end;
+    bool         ok;
+
+    uint32_t u32() {
+        uint32_t v = 0;
+        if(end - p < (std::ptrdiff_t)sizeof(v)) {
+            ok = false;
+            return 0;
+        }
+        std::memcpy(&v, p, sizeof(v));
+        p += sizeof(v);
+        return v;
+    }
+    std::string str() {
+        uint32_t len = u32();
+        if(end - p < (std::ptrdiff_t)len) {
+            ok = false;
+            return "";
+        }
+        p += len;
+        return std::string(p - len, len);
+    }
+} DeclReader;
+
+//! Pad the output with zeros to the next multiple of 8 bytes.
+static bool pad(FILE * out, uint64_t & pos) {
+    static const char zeros[8] = {0};
+    size_t n = (8 - pos % 8) % 8;
+    pos += n;
+    return std::fwrite(zeros, 1, n, out) == n;
+}
+
+//! Write bytes, tracking the position.
+static bool put(FILE * out, uint64_t & pos, const void * data, size_t size) {
+    pos += size;
+    return std::fwrite(data, 1, size, out) == size;
+}
+
+bool VCDFile::write_cache(const std::string & cachepath,
+                          const std::string & sourcepath) {
+    struct stat st;
+    if(stat(sourcepath.c_str(), &st) != 0)
+        return false;
+
+    // Declarations. Scopes are in the order they were added, so a parent
+    // always comes before its children.
+    std::map<VCDScope *, uint32_t> scope_index;
+    for(VCDScope * scope : this->scopes)
+        scope_index.insert(std::make_pair(scope, scope_index.size()));
+    std::string decl;
+    put_str(decl, this->date);
+    put_str(decl, this->version);
+    put_u32(decl, this->time_resolution);
+    put_u32(decl, this->time_units);
+    put_u32(decl, this->scopes.size());
+    for(VCDScope * scope : this->scopes) {
+        put_str(decl, scope->name);
+        put_u32(decl, scope->type);
+        put_u32(decl, scope->parent ? scope_index[scope->parent] : ~0u);
+    }
+    put_u32(decl, this->signals.size());
+    for(VCDSignal * signal : this->signals) {
+        put_str(decl, signal->hash);
+        put_str(decl, signal->reference);
+        put_u32(decl, signal->size);
+        put_u32(decl, signal->type);
+        put_u32(decl, signal->scope ? scope_index[signal->scope] : ~0u);
+    }
+
+    VCDCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version         = CACHE_VERSION;
+    header.value_size      = sizeof(VCDValue);
+    header.source_size     = st.st_size;
+    header.source_mtime    = st.st_mtim.tv_sec;
+    header.source_mtime_ns = st.st_mtim.tv_nsec;
+    header.decl_offset     = sizeof(header);
+    header.decl_size       = decl.size();
+    // Times are encoded up front, the sizes are needed for the layout.
+    std::vector<uint8_t> times;
+    VCDTime prev = 0;
+    for(VCDTime time : this->times) {
+        put_delta(times, prev, time);
+        prev = time;
+    }
+    header.times_offset    = (header.decl_offset + decl.size() + 7) & ~7ull;
+    header.times_size      = times.size();
+    header.time_count      = this->times.size();
+    header.columns_offset  = (header.times_offset + times.size() + 7) & ~7ull;
+    header.handle_count    = this->val_map.size();
+
+    // Lay out the columns before writing anything, the table comes first.
+    std::vector<VCDCacheColumn> columns(this->val_map.size());
+    std::vector<std::vector<uint8_t>> column_times(columns.size());
+    uint64_t pos = header.columns_offset +
+                   columns.size() * sizeof(VCDCacheColumn);
+    for(size_t h = 0; h < columns.size(); h++) {
+        VCDSignalValues * values = this->val_map[h];
+        columns[h].count         = values->size();
+        columns[h].first         = values->empty() ? 0 : (*values)[0].time;
+        columns[h].last          = values->empty() ? 0 : values->back().time;
+        // The first time is in the column, the others are differences.
+        bool first = true;
+        for(VCDTimedValue tv : *values) {
+            if(!first)
+                put_delta(column_times[h], prev, tv.time);
+            prev  = tv.time;
+            first = false;
+        }
+        columns[h].times_offset  = pos;
+        columns[h].times_size    = column_times[h].size();
+        columns[h].values_offset = (pos + column_times[h].size() + 7) & ~7ull;
+        pos = columns[h].values_offset + values->size() * sizeof(VCDValue);
+        for(VCDTimedValue tv : *values)
+            if(tv.value->get_type() == VCD_VECTOR)
+                pos += tv.value->get_value_vector()->words() > 1 ?
+                    2 * tv.value->get_value_vector()->words() *
+                    sizeof(uint64_t) : 0;
+        pos = (pos + 7) & ~7ull;
+    }
+
+    // A name of its own, so writers of the same cache never share a file,
+    // with the permissions of the source it repeats.
+    std::string tmppath = cachepath + ".XXXXXX";
+    int fd = mkstemp(&tmppath[0]);
+    if(fd < 0)
+        return false;
+    fchmod(fd, st.st_mode & 0666);
+    FILE * out = fdopen(fd, "wb");
+    if(!out) {
+        close(fd);
+        std::remove(tmppath.c_str());
+        return false;
+    }
+    bool ok = true;
+    pos = 0;
+    ok = ok && put(out, pos, &header, sizeof(header));
+    ok = ok && put(out, pos, decl.data(), decl.size()) && pad(out, pos);
+    ok = ok && put(out, pos, times.data(), times.size()) && pad(out, pos);
+    ok = ok && put(out, pos, columns.data(),
+                   columns.size() * sizeof(VCDCacheColumn));
+    for(size_t h = 0; ok && h < columns.size(); h++) {
+        VCDSignalValues * values = this->val_map[h];
+        ok = ok && put(out, pos, column_times[h].data(),
+                       column_times[h].size()) && pad(out, pos);
+        // Planes of wide vectors follow the records, in the same order.
+        uint64_t planes = pos + values->size() * sizeof(VCDValue);
+        for(VCDTimedValue tv : *values) {
+            alignas(VCDValue) char record[sizeof(VCDValue)];
+            std::memcpy(record, tv.value, sizeof(VCDValue));
+            if(tv.value->get_type() == VCD_VECTOR &&
+               tv.value->get_value_vector()->words() > 1) {
+                // The offset is taken from the vector inside the record.
+                VCDBitVector * copy =
+                    ((VCDValue *)record)->get_value_vector();
+                copy->set_block_offset(planes - pos -
+                                       ((char *)copy - record));
+                planes += 2 * tv.value->get_value_vector()->words() *
+                          sizeof(uint64_t);
+            }
+            ok = ok && put(out, pos, record, sizeof(VCDValue));
+        }
+        for(VCDTimedValue tv : *values) {
+            if(tv.value->get_type() != VCD_VECTOR)
+                continue;
+            const VCDBitVector * vec = tv.value->get_value_vector();
+            if(vec->words() > 1) {
+                ok = ok && put(out, pos, vec->value_words(),
+                               vec->words() * sizeof(uint64_t));
+                ok = ok && put(out, pos, vec->xz_words(),
+                               vec->words() * sizeof(uint64_t));
+            }
+        }
+        ok = ok && pad(out, pos);
+    }
+    ok = (std::fclose(out) == 0) && ok;
+    if(ok)
+        ok = std::rename(tmppath.c_str(), cachepath.c_str()) == 0;
+    if(!ok)
+        std::remove(tmppath.c_str());
+    return ok;
+}
+
+bool VCDFile::read_cache(const std::string & cachepath,
+                         const std::string & sourcepath) {
+    struct stat src, st;
+    if(stat(sourcepath.c_str(), &src) != 0)
+        return false;
+    int fd = open(cachepath.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(VCDCacheHeader)) {
+        close(fd);
+        return false;
+    }
+    // Private and writable, so values can be modified like parsed ones
+    // without touching the file.
+    void * base = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED)
+        return false;
+    const char * map  = (const char *)base;
+    uint64_t     size = st.st_size;
+
+    const VCDCacheHeader * header = (const VCDCacheHeader *)map;
+    bool ok = std::memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0
+        && header->version         == CACHE_VERSION
+        && header->value_size      == sizeof(VCDValue)
+        && header->source_size     == (uint64_t)src.st_size
+        && header->source_mtime    == src.st_mtim.tv_sec
+        && header->source_mtime_ns == src.st_mtim.tv_nsec
+        && header->decl_offset <= size
+        && header->decl_size <= size - header->decl_offset
+        && header->times_offset <= size
+        && header->times_size <= size - header->times_offset
+        && header->columns_offset <= size
+        && header->columns_offset % 8 == 0
+        && header->handle_count <=
+           (size - header->columns_offset) / sizeof(VCDCacheColumn);
+    if(!ok) {
+        munmap(base, size);
+        return false;
+    }
+
+    DeclReader in = {map + header->decl_offset,
+                     map + header->decl_offset + header->decl_size, true};
+    this->date            = in.str();
+    this->version         = in.str();
+    this->time_resolution = in.u32();
+    this->time_units      = (VCDTimeUnit)in.u32();
+    std::vector<VCDScope *> scopes(in.u32());
+    for(size_t i = 0; in.ok && i < scopes.size(); i++) {
+        VCDScope * scope = new VCDScope();
+        scope->name = in.str();
+        scope->type = (VCDScopeType)in.u32();
+        uint32_t parent = in.u32();
+        scope->parent = parent < i ? scopes[parent] : nullptr;
+        if(scope->parent)
+            scope->parent->children.push_back(scope);
+        scopes[i] = scope;
+        add_scope(scope);
+    }
+    this->root_scope = scopes.empty() ? nullptr : scopes[0];
+    uint32_t signal_count = in.u32();
+    for(size_t i = 0; in.ok && i < signal_count; i++) {
+        VCDSignal * signal = new VCDSignal();
+        signal->hash      = in.str();
+        signal->reference = in.str();
+        signal->size      = in.u32();
+        signal->type      = (VCDVarType)in.u32();
+        uint32_t scope = in.u32();
+        if(scope >= scopes.size()) {
+            delete signal;
+            in.ok = false;
+            break;
+        }
+        signal->scope = scopes[scope];
+        signal->scope->signals.push_back(signal);
+        add_signal(signal);
+    }
+    if(!in.ok || this->val_map.size() != header->handle_count) {
+        munmap(base, size);
+        return false;
+    }
+
+    // A difference takes at least a byte, so the count bounds the reads.
+    const uint8_t * times = (const uint8_t *)(map + header->times_offset);
+    const uint8_t * times_end = times + header->times_size;
+    VCDTime time = 0;
+    this->times.clear();
+    for(uint64_t i = 0; i < header->time_count; i++) {
+        if(!get_delta(times, times_end, time))
+            break;
+        this->times.push_back(time);
+    }
+    if(this->times.size() != header->time_count) {
+        munmap(base, size);
+        return false;
+    }
+
+    // Everything a column refers to is checked before it is used, so a
+    // truncated or mixed cache is turned down rather than read past.
+    const VCDCacheColumn * columns =
+        (const VCDCacheColumn *)(map + header->columns_offset);
+    for(size_t h = 0; ok && h < header->handle_count; h++) {
+        const VCDCacheColumn & column = columns[h];
+        // Compared with what is left, so large sizes cannot wrap around.
+        ok = column.times_offset <= size &&
+             column.times_size <= size - column.times_offset &&
+             column.values_offset <= size &&
+             column.values_offset % 8 == 0 &&
+             column.count <= (size - column.values_offset) / sizeof(VCDValue);
+        const uint8_t  * deltas = (const uint8_t *)(map + column.times_offset);
+        const uint8_t  * deltas_end = deltas + column.times_size;
+        VCDValue       * values = (VCDValue *)(map + column.values_offset);
+        for(uint64_t i = 0; ok && i < column.count; i++)
+            ok = valid_record(values[i], map, size);
+        // The differences are decoded in full, to the last byte, which also
+        // gives the first time of each block after the first.
+        VCDTime t = column.first;
+        for(uint64_t i = 0; ok && i < column.count; i += CACHE_BLOCK) {
+            VCDValueBlock * block = (VCDValueBlock *)
+                this->arena.allocate(sizeof(VCDValueBlock));
+            block->count    = std::min(column.count - i, CACHE_BLOCK);
+            block->capacity = block->count;
+            block->first    = t;
+            block->deltas   = (uint8_t *)deltas;
+            block->values   = values + i;
+            for(uint32_t n = 1; ok && n < block->count; n++)
+                ok = get_delta(deltas, deltas_end, t);
+            block->last       = t;
+            block->delta_size = deltas - block->deltas;
+            block->delta_room = block->delta_size;
+            if(ok && i + block->count < column.count)
+                ok = get_delta(deltas, deltas_end, t);
+            if(ok)
+                this->val_map[h]->append(block);
+        }
+        ok = ok && deltas == deltas_end &&
+             (column.count == 0 || t == column.last);
+    }
+    if(!ok) {
+        munmap(base, size);
+        return false;
+    }
+    this->cache_base = base;
+    this->cache_size = size;
+    return true;
+}
+
+void VCDFile::unmap_cache() {
+    if(this->cache_base)
+        munmap(this->cache_base, this->cache_size);
+    this->cache_base = nullptr;
+    this->cache_size = 0;
+}
@@ -0,0 +1,188 @@
+/*!
+@file
+@brief Definition of the VCDDiff class.
+*/
+
+#include <algorithm>
+#include <limits>
+#include <set>
+
+#include "VCDTypes.hpp"
+
+//! A value as it is written in a VCD file, "none" before the first one.
+static std::string value_text(const VCDValue * value) {
+    if(!value)
+        return "none";
+    switch(value->get_type()) {
+    case VCD_SCALAR:
+        return std::string(1, "01xz"[value->get_value_bit()]);
+    case VCD_VECTOR:
+        return "b" + value->get_value_vector()->to_string();
+    default:
+        char text[32];
+        std::snprintf(text, sizeof(text), "r%.17g", value->get_value_real());
+        return text;
+    }
+}
+
+//! True if a and b are not both missing or equal.
+static bool differ(const VCDValue * a, const VCDValue * b) {
+    if(!a || !b)
+        return a != b;
+    return *a != *b;
+}
+
+/*!
+@brief The values of handle in file.
+@details A compressed history is expanded into values, taking storage from
+arena, so it is freed with them rather than kept by the file.
+*/
+static const VCDSignalValues * signal_values(VCDFile * file,
+                                             VCDSignalHandle handle,
+                                             VCDSignalValues & values,
+                                             VCDArena & arena) {
+    const VCDHistory * history = file->get_history(handle);
+    if(!history)
+        return file->get_signal_values(handle);
+    history->expand(values, arena);
+    return &values;
+}
+
+VCDDiff::VCDDiff() :
+    from(0), to(std::numeric_limits<VCDTime>::max()), threads(0),
+    compared(0), timescale_differs(false) {}
+
+bool VCDDiff::compare(const VCDSignalValues * a, const VCDSignalValues * b,
+                      VCDDifference & difference) const {
+    const VCDTime          end = std::numeric_limits<VCDTime>::max();
+    VCDSignalValues::iterator ia = a->begin(), ib = b->begin();
+    const VCDValue         * va = nullptr, * vb = nullptr;
+    bool                     started = false;
+    for(;;) {
+        VCDTime time = end;
+        if(ia != a->end())
+            time = ia->time;
+        if(ib != b->end())
+            time = std::min(time, ib->time);
+        // The values in force at from are compared once it is reached.
+        if(!started && (time > this->from || time == end)) {
+            started = true;
+            if(this->from <= this->to && differ(va, vb)) {
+                difference.time = this->from;
+                break;
+            }
+        }
+        if(time == end || time > this->to)
+            return false;
+        for(; ia != a->end() && ia->time == time; ++ia)
+            va = ia->value;
+        for(; ib != b->end() && ib->time == time; ++ib)
+            vb = ib->value;
+        if(time >= this->from) {
+            started = true;
+            if(differ(va, vb)) {
+                difference.time = time;
+                break;
+            }
+        }
+    }
+    difference.golden = value_text(va);
+    difference.other  = value_text(vb);
+    return true;
+}
+
+void VCDDiff::compare(VCDFile * golden, VCDFile * other) {
+    this->only_golden.clear();
+    this->only_other.clear();
+    this->differences.clear();
+    this->timescale_differs =
+        golden->time_units != other->time_units ||
+        golden->time_resolution != other->time_resolution;
+
+    // Each pair of handles is compared once, under the path of the first
+    // signal that has it.
+    std::vector<std::pair<VCDSignalHandle, VCDSignalHandle>> pairs;
+    std::vector<std::string>                                 paths;
+    std::set<std::pair<VCDSignalHandle, VCDSignalHandle>>    seen;
+    for(VCDSignal * signal : *golden->get_signals()) {
+        std::string path  = VCDFile::signal_path(signal);
+        VCDSignal * match = other->get_signal(path);
+        if(!match) {
+            this->only_golden.push_back(path);
+            continue;
+        }
+        auto pair = std::make_pair(signal->handle, match->handle);
+        if(seen.insert(pair).second) {
+            pairs.push_back(pair);
+            paths.push_back(path);
+        }
+    }
+    for(VCDSignal * signal : *other->get_signals()) {
+        std::string path = VCDFile::signal_path(signal);
+        if(!golden->get_signal(path))
+            this->only_other.push_back(path);
+    }
+    this->compared = pairs.size();
+
+    // Signals are handed out one at a time, each stops at its first
+    // difference so the work per signal is hard to predict.
+    std::vector<VCDDifference> found(pairs.size());
+    std::vector<uint8_t>       differs(pairs.size(), 0);
+    std::atomic<size_t>        next(0);
+    auto work = [&]() {
+        for(size_t i; (i = next++) < pairs.size();) {
+            VCDArena        arena;
+            VCDSignalValues a, b;
+            differs[i] = compare(
+                signal_values(golden, pairs[i].first, a, arena),
+                signal_values(other, pairs[i].second, b, arena), found[i]);
+        }
+    };
+    size_t count = this->threads;
+    if(count == 0)
+        count = std::max(1u, std::thread::hardware_concurrency());
+    count = std::min(count, pairs.size());
+    std::vector<std::thread> workers;
+    for(size_t i = 1; i < count; i++)
+        workers.push_back(std::thread(work));
+    work();
+    for(std::thread & worker : workers)
+        worker.join();
+
+    for(size_t i = 0; i < pairs.size(); i++) {
+        if(!differs[i])
+            continue;
+        found[i].path = paths[i];
+        this->differences.push_back(found[i]);
+    }
+    std::sort(this->differences.begin(), this->differences.end(),
+              [](const VCDDifference & a, const VCDDifference & b) {
+                  if(a.time != b.time)
+                      return a.time < b.time;
+                  return a.path < b.path;
+              });
+}
+
+void VCDDiff::print(FILE * out, size_t top) const {
+    if(this->timescale_differs)
+        std::fprintf(out, "timescales differ\n");
+    for(const std::string & path : this->only_golden)
+        std::fprintf(out, "only in golden: %s\n", path.c_str());
+    for(const std::string & path : this->only_other)
+        std::fprintf(out, "only in new:    %s\n", path.c_str());
+    size_t shown = std::min(top, this->differences.size());
+    if(shown)
+        std::fprintf(out, "%20s  %-20s %-20s %s\n", "time", "golden", "new",
+                     "signal");
+    for(size_t i = 0; i < shown; i++) {
+        const VCDDifference & d = this->differences[i];
+        std::fprintf(out, "%20llu  %-20s %-20s %s\n",
+                     (unsigned long long)d.time, d.golden.c_str(),
+                     d.other.c_str(), d.path.c_str());
+    }
+    if(shown < this->differences.size())
+        std::fprintf(out, "... %zu more\n", this->differences.size() - shown);
+    std::fprintf(out, "%zu signals compared, %zu differ, %zu unmatched\n",
+                 this->compared, this->differences.size(),
+                 this->only_golden.size() + this->only_other.size());
+}
@@ -0,0 +1,740 @@
+/*!
+@file
+@brief Memory mapped input and the fast path decoder for value changes.
+@details Everything after $enddefinitions is a flat list of timestamps and
+value changes, so it is decoded here with a hand written loop over the
+mapped file rather than token by token through flex and bison.
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "VCDTypes.hpp"
+
+//! True if c can appear in a VCD identifier code.
+static inline bool is_idcode_char(char c) {
+    return (unsigned char)(c - '!') <= ('~' - '!');
+}
+
+//! True if c is whitespace separating VCD tokens.
+static inline bool is_blank(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+//! Convert a value character into a VCDBit, as the scanner does.
+static inline VCDBit char2bit(char c) {
+    switch(c) {
+    case '0':
+        return VCD_0;
+    case '1':
+        return VCD_1;
+    case 'z':
+    case 'Z':
+        return VCD_Z;
+    case 'x':
+    case 'X':
+    default:
+        return VCD_X;
+    }
+}
+
+//! Find the first occurrence of the NUL terminated needle in [p,end).
+static const char * find_text(const char * p, const char * end,
+                              const char * needle) {
+    size_t len = std::strlen(needle);
+    while(end - p >= (std::ptrdiff_t)len) {
+        p = (const char *)std::memchr(p, needle[0], end - p - len + 1);
+        if(!p)
+            return nullptr;
+        if(std::memcmp(p, needle, len) == 0)
+            return p;
+        p++;
+    }
+    return nullptr;
+}
+
+/*!
+@brief Watch path for changes with inotify.
+@returns A non-blocking inotify descriptor or -1 if inotify is unavailable.
+*/
+static int watch_file(const std::string & path) {
+    int notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(notify >= 0 &&
+       inotify_add_watch(notify, path.c_str(), IN_MODIFY | IN_ATTRIB |
+                         IN_DELETE_SELF | IN_MOVE_SELF) < 0) {
+        close(notify);
+        notify = -1;
+    }
+    return notify;
+}
+
+/*!
+@brief Wait until the file at path is longer than size bytes.
+@param notify Descriptor from watch_file, -1 to poll.
+@returns false if the file shrank or went away, or stopped was set.
+*/
+static bool wait_for_growth(const std::string & path, off_t size, int notify,
+                            const std::atomic<bool> & stopped) {
+    // Wake up regularly even with inotify, to notice stopped.
+    const int poll_ms = 100;
+    while(!stopped) {
+        struct stat st;
+        if(stat(path.c_str(), &st) != 0 || st.st_size < size)
+            return false;
+        if(st.st_size > size)
+            return true;
+        if(notify >= 0) {
+            struct pollfd pfd = {notify, POLLIN, 0};
+            char events[4096];
+            if(poll(&pfd, 1, poll_ms) > 0)
+                while(read(notify, events, sizeof(events)) > 0)
+                    ;
+        } else {
+            usleep(poll_ms * 1000);
+        }
+    }
+    return false;
+}
+
+bool VCDFileParser::map_input() {
+    if(!this->follow)
+        return try_map_input();
+    // The simulator may not have written all the declarations yet.
+    int  notify = watch_file(this->filepath);
+    bool mapped = false;
+    struct stat st;
+    while(stat(this->filepath.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+        mapped = try_map_input();
+        if(mapped || !wait_for_growth(this->filepath, st.st_size, notify,
+                                      this->stopped))
+            break;
+    }
+    if(notify >= 0)
+        close(notify);
+    return mapped;
+}
+
+bool VCDFileParser::try_map_input() {
+    int fd = open(filepath.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void * base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED)
+        return false;
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+    const char * begin = (const char *)base;
+    const char * end   = begin + st.st_size;
+    const char * defs  = find_text(begin, end, "$enddefinitions");
+    const char * body  = defs ? find_text(defs + 15, end, "$end") : nullptr;
+    if(!body) {
+        munmap(base, st.st_size);
+        return false;
+    }
+    this->map_base   = begin;
+    this->map_size   = st.st_size;
+    this->body_begin = body + 4;
+    this->body_end   = end;
+    return true;
+}
+
+void VCDFileParser::unmap_input() {
+    if(this->map_base)
+        munmap((void *)this->map_base, this->map_size);
+    this->map_base   = nullptr;
+    this->map_size   = 0;
+    this->body_begin = nullptr;
+    this->body_end   = nullptr;
+}
+
+/*!
+@brief Passes decoded values to the parser, which stores or reports them.
+*/
+struct ParserSink {
+    VCDFileParser & driver;
+
+    void rebase(const char *, uint64_t) {}
+    void timestamp(VCDTime time, const char *) {
+        this->driver.add_timestamp(time);
+    }
+    void value(VCDSignalHandle handle, VCDTime time, const VCDValue & value) {
+        this->driver.add_value(handle, time, value);
+    }
+    bool done() const {
+        return this->driver.past_window();
+    }
+};
+
+/*!
+@brief Collects decoded values into a VCDValueRange.
+*/
+struct RangeSink {
+    VCDValueRange & range;
+
+    void timestamp(VCDTime time, const char *) {
+        this->range.times.push_back(time);
+    }
+    void value(VCDSignalHandle handle, VCDTime time, const VCDValue & value) {
+        if(this->range.histories.empty())
+            this->range.values[handle].push_back(this->range.arena, time,
+                                                 value);
+        else
+            this->range.histories[handle]->push_back(time, value);
+    }
+};
+
+/*!
+@brief Tracks the current value of each handle and adds a checkpoint to a
+VCDCheckpointIndex at the first timestamp of each interval.
+*/
+struct IndexSink {
+    VCDCheckpointIndex &  index;
+    //! Start of the data being decoded, which is at offset origin.
+    const char *          base;
+    uint64_t              origin;
+    std::vector<VCDValue> current;
+    std::vector<uint8_t>  known;
+    //! Time at or after which the next checkpoint is due.
+    VCDTime               next;
+
+    IndexSink(VCDCheckpointIndex & index, const char * base) :
+        index(index), base(base), origin(0),
+        current(index.handle_count, VCDValue(VCD_X)),
+        known(index.handle_count, 0), next(0) {}
+    bool done() const {
+        return false;
+    }
+
+    void rebase(const char * base, uint64_t origin) {
+        this->base   = base;
+        this->origin = origin;
+    }
+    void timestamp(VCDTime time, const char * marker) {
+        if(time < this->next)
+            return;
+        this->index.add(time, this->origin + (marker - this->base),
+                        this->current.data(), this->known.data());
+        this->next = time + this->index.interval;
+    }
+    void value(VCDSignalHandle handle, VCDTime, const VCDValue & value) {
+        VCDValue & cur = this->current[handle];
+        if(cur.get_type() == VCD_VECTOR && value.get_type() == VCD_VECTOR)
+            *cur.get_value_vector() = *value.get_value_vector();
+        else
+            cur = value;
+        this->known[handle] = 1;
+    }
+};
+
+/*!
+@brief Decode the value changes in [p,end) into sink.
+@param time Time in force at p.
+@param vector_value Scratch value for vectors.
+@param extend Extend vector values to the size of their signal.
+@param release Drop mapped pages once they have been decoded.
+@returns The time in force at end.
+*/
+template<class Sink>
+static VCDTime decode_values(const VCDFile * fh, const char * p,
+                             const char * end, VCDTime time,
+                             VCDValue & vector_value, bool extend,
+                             Sink & sink, bool release) {
+    const size_t release_step = 8 << 20;
+    const char * released = (const char *)(
+        ((uintptr_t)p + release_step - 1) & ~(uintptr_t)(release_step - 1));
+    while(p < end) {
+        if(release && p - released >= (std::ptrdiff_t)release_step) {
+            const char * upto = (const char *)(
+                (uintptr_t)p & ~(uintptr_t)(release_step - 1));
+            madvise((void *)released, upto - released, MADV_DONTNEED);
+            released = upto;
+        }
+        char c = *p;
+        if(is_blank(c)) {
+            p++;
+            continue;
+        }
+
+        const char * val = p;
+        const char * val_end;
+        switch(c) {
+        case '#':
+            time = vcd_parse_time(++p, end);
+            sink.timestamp(time, val);
+            continue;
+        case '$': {
+            // $dumpvars and friends only bracket ordinary value changes, but
+            // a $comment body has to be skipped as a whole.
+            const char * kw = p;
+            while(p < end && !is_blank(*p))
+                p++;
+            if(p - kw == 8 && std::memcmp(kw, "$comment", 8) == 0) {
+                const char * e = find_text(p, end, "$end");
+                p = e ? e + 4 : end;
+            }
+            continue;
+        }
+        case '0': case '1':
+        case 'x': case 'X':
+        case 'z': case 'Z':
+            val_end = ++p;
+            break;
+        case 'b': case 'B':
+        case 'r': case 'R':
+            for(p++; p < end && !is_blank(*p); p++)
+                ;
+            val_end = p;
+            break;
+        default:
+            p++;
+            continue;
+        }
+
+        while(p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        const char * id = p;
+        while(p < end && is_idcode_char(*p))
+            p++;
+        VCDSignalHandle handle = fh->get_handle(id, p - id);
+        if(handle == VCD_HANDLE_NONE)
+            continue;
+
+        if(c == 'b' || c == 'B') {
+            vector_value.get_value_vector()->assign(val + 1, val_end - val - 1,
+                extend ? fh->get_handle_size(handle) : 0);
+            sink.value(handle, time, vector_value);
+        } else if(c == 'r' || c == 'R') {
+            VCDReal real = std::strtod(val + 1, nullptr);
+            sink.value(handle, time, VCDValue(real));
+        } else {
+            sink.value(handle, time, VCDValue(char2bit(c)));
+        }
+    }
+    return time;
+}
+
+void VCDFileParser::scan_values(const char * p, const char * end) {
+    ParserSink sink = {*this};
+    // Nothing points back into the mapping, so decoded pages can go when
+    // streaming, compressing or when memory is budgeted.
+    this->current_time = decode_values(this->fh, p, end, this->current_time,
+                                 this->vector_value, this->extend_vectors,
+                                 sink, this->visitor || this->memory_budget ||
+                                       this->fh->is_compressed());
+}
+
+void VCDFileParser::scan_follow() {
+    // The last line may still be being written, so only whole lines are
+    // decoded and the rest waits in pending.
+    const char * end = (const char *)memrchr(this->body_begin, '\n',
+                                             this->body_end - this->body_begin);
+    end = end ? end + 1 : this->body_begin;
+    scan_values(this->body_begin, end);
+    std::string pending(end, this->body_end);
+    off_t size = this->map_size;
+
+    int fd = open(this->filepath.c_str(), O_RDONLY);
+    if(fd < 0)
+        return;
+    int notify = watch_file(this->filepath);
+    std::vector<char> buffer(1 << 20);
+    ParserSink sink = {*this};
+    while(!this->stopped) {
+        ssize_t n = pread(fd, buffer.data(), buffer.size(), size);
+        if(n > 0) {
+            size += n;
+            pending.append(buffer.data(), n);
+            const char * data = pending.data();
+            const char * last = (const char *)memrchr(data, '\n',
+                                                      pending.size());
+            if(last) {
+                this->current_time = decode_values(this->fh, data, last + 1,
+                                                   this->current_time,
+                                                   this->vector_value,
+                                                   this->extend_vectors, sink,
+                                                   false);
+                pending.erase(0, last + 1 - data);
+            }
+            continue;
+        }
+        if(n < 0)
+            break;
+        if(this->visitor)
+            this->visitor->on_wait();
+        if(!wait_for_growth(this->filepath, size, notify, this->stopped))
+            break;
+    }
+    if(notify >= 0)
+        close(notify);
+    close(fd);
+}
+
+void VCDFileParser::scan_range(const char * p, const char * end,
+                               VCDTime time, VCDValueRange & range) const {
+    RangeSink sink = {range};
+    range.end_time = decode_values(this->fh, p, end, time,
+                                   range.vector_value,
+                                   this->extend_vectors, sink,
+                                   this->memory_budget != 0 ||
+                                   !range.histories.empty());
+}
+
+void VCDFileParser::scan_parallel() {
+    // Ranges smaller than this are not worth a thread.
+    const size_t min_range = 1 << 20;
+    size_t size = this->body_end - this->body_begin;
+    size_t count = this->threads;
+    if(count == 0)
+        count = std::max(1u, std::thread::hardware_concurrency());
+    count = std::min(count, size / min_range);
+    if(count <= 1) {
+        scan_values(this->body_begin, this->body_end);
+        return;
+    }
+
+    // Cut at the start of a timestamp line after each even split point.
+    std::vector<const char *> bounds(1, this->body_begin);
+    for(size_t i = 1; i < count; i++) {
+        const char * p = std::max(bounds.back(),
+                                  this->body_begin + size * i / count);
+        const char * cut = find_text(p, this->body_end, "\n#");
+        if(!cut)
+            break;
+        bounds.push_back(cut + 1);
+    }
+    bounds.push_back(this->body_end);
+
+    // Only the first range knows the time in force at its start, the others
+    // begin with a timestamp.
+    std::vector<VCDValueRange *> ranges;
+    std::vector<std::thread>     workers;
+    for(size_t i = 0; i + 1 < bounds.size(); i++) {
+        // Compressed ranges keep nothing uncompressed while the others run.
+        ranges.push_back(new VCDValueRange(this->fh->get_handle_count(),
+                                           this->fh->is_compressed()));
+        ranges.back()->arena.set_spill(this->fh->get_spill());
+        workers.push_back(std::thread(&VCDFileParser::scan_range, this,
+                                      bounds[i], bounds[i + 1], this->current_time,
+                                      std::ref(*ranges.back())));
+    }
+    for(std::thread & worker : workers)
+        worker.join();
+    VCD_STATS(VCDStatsTimer timer(this->stats, VCDStats::STATS_MERGE);)
+    for(VCDValueRange * range : ranges) {
+        this->fh->append_values(*range);
+        this->current_time = range->end_time;
+        delete range;
+    }
+}
+
+void VCDFileParser::scan_index() {
+    this->index_out->handle_count = this->fh->get_handle_count();
+    this->index_out->set_source(this->filepath);
+    IndexSink sink(*this->index_out, this->map_base);
+    this->current_time = decode_values(this->fh, this->body_begin,
+                                       this->body_end, this->current_time,
+                                       this->vector_value,
+                                       this->extend_vectors, sink, false);
+}
+
+void VCDFileParser::scan_resume() {
+    // Report the checkpoint under its own timestamp, then carry on after it.
+    const char * p = this->map_base + this->resume_at->offset;
+    for(p++; p < this->body_end && *p >= '0' && *p <= '9'; p++)
+        ;
+    this->current_time = this->resume_at->time;
+    add_timestamp(this->current_time);
+    for(size_t h = 0; h < this->fh->get_handle_count(); h++)
+        if(this->resume_at->known[h])
+            add_value(h, this->current_time, this->resume_at->values[h]);
+    scan_values(p, this->body_end);
+}
+
+/*!
+@brief Find the first timestamp in [p,end) at or after time, skipping over
+the value changes before it without decoding them.
+@param latest Receives the begin and end of the last change of each handle,
+at 2 * handle and 2 * handle + 1, which stay nullptr for handles without one.
+@param found Receives the time of the timestamp found.
+@returns The '#' of that timestamp, or end if there is none.
+*/
+static const char * skip_values(const VCDFile * fh, const char * p,
+                                const char * end, VCDTime time,
+                                std::vector<const char *> & latest,
+                                VCDTime & found) {
+    while(p < end) {
+        char c = *p;
+        if(is_blank(c)) {
+            p++;
+            continue;
+        }
+        const char * val = p;
+        switch(c) {
+        case '#':
+            found = vcd_parse_time(++p, end);
+            if(found >= time)
+                return val;
+            continue;
+        case '$': {
+            const char * kw = p;
+            while(p < end && !is_blank(*p))
+                p++;
+            if(p - kw == 8 && std::memcmp(kw, "$comment", 8) == 0) {
+                const char * e = find_text(p, end, "$end");
+                p = e ? e + 4 : end;
+            }
+            continue;
+        }
+        case '0': case '1':
+        case 'x': case 'X':
+        case 'z': case 'Z':
+            p++;
+            break;
+        case 'b': case 'B':
+        case 'r': case 'R':
+            for(p++; p < end && !is_blank(*p); p++)
+                ;
+            break;
+        default:
+            p++;
+            continue;
+        }
+        while(p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        const char * id = p;
+        while(p < end && is_idcode_char(*p))
+            p++;
+        VCDSignalHandle handle = fh->get_handle(id, p - id);
+        if(handle == VCD_HANDLE_NONE)
+            continue;
+        latest[2 * handle]     = val;
+        latest[2 * handle + 1] = p;
+    }
+    return end;
+}
+
+void VCDFileParser::scan_window() {
+    const char * p   = this->body_begin;
+    const char * end = this->body_end;
+    VCDTime      next = 0;
+    if(this->window_begin > 0) {
+        std::vector<const char *> latest(2 * this->fh->get_handle_count(),
+                                         nullptr);
+        p = skip_values(this->fh, p, end, this->window_begin, latest, next);
+        // Only the last change of each handle is decoded, and reported as
+        // a checkpoint would be.
+        this->current_time = this->window_begin;
+        add_timestamp(this->current_time);
+        ParserSink sink = {*this};
+        for(size_t h = 0; 2 * h < latest.size(); h++)
+            if(latest[2 * h])
+                decode_values(this->fh, latest[2 * h], latest[2 * h + 1],
+                              this->current_time, this->vector_value,
+                              this->extend_vectors, sink, false);
+        if(p < end && next == this->window_begin)
+            for(p++; p < end && *p >= '0' && *p <= '9'; p++)
+                ;
+    }
+    // Cut at the first timestamp line after the window.
+    for(const char * q = p; q < end; q++) {
+        if(*q == '#' && (q == p || q[-1] == '\n')) {
+            const char * t = q + 1;
+            if(vcd_parse_time(t, end) > this->window_end) {
+                end = q;
+                break;
+            }
+            q = t;
+        }
+        q = (const char *)std::memchr(q, '\n', end - q);
+        if(!q)
+            break;
+    }
+    this->body_begin = p;
+    this->body_end   = end;
+    if(this->visitor)
+        scan_values(p, end);
+    else
+        scan_parallel();
+}
+
+bool VCDFileParser::window_timestamp(VCDTime time) {
+    if(this->window_closed)
+        return false;
+    // The values in force at window_begin are due even when the first
+    // timestamp reaching it is past window_end.
+    bool reported = false;
+    if(!this->window_open && time >= this->window_begin) {
+        open_window();
+        reported = time == this->window_begin;
+    }
+    if(time > this->window_end) {
+        // Ends follow mode, the pipe and the grammar early.
+        this->window_closed = true;
+        this->stopped       = true;
+        return false;
+    }
+    return this->window_open && !reported;
+}
+
+bool VCDFileParser::window_value(VCDSignalHandle handle,
+                                 const VCDValue & value) {
+    if(this->window_open)
+        return !this->window_closed;
+    if(this->window_values.size() < this->fh->get_handle_count()) {
+        this->window_values.resize(this->fh->get_handle_count(),
+                                   VCDValue(VCD_X));
+        this->window_known.resize(this->fh->get_handle_count(), 0);
+    }
+    VCDValue & kept = this->window_values[handle];
+    if(kept.get_type() == VCD_VECTOR && value.get_type() == VCD_VECTOR)
+        *kept.get_value_vector() = *value.get_value_vector();
+    else
+        kept = value;
+    this->window_known[handle] = 1;
+    return false;
+}
+
+void VCDFileParser::open_window() {
+    this->window_open   = true;
+    this->window_filter = false;
+    add_timestamp(this->window_begin);
+    for(size_t h = 0; h < this->window_known.size(); h++)
+        if(this->window_known[h])
+            add_value(h, this->window_begin, this->window_values[h]);
+    this->window_filter = true;
+    this->window_values.clear();
+    this->window_known.clear();
+}
+
+/*!
+@brief Decode the value changes from pipe into sink.
+@details Buffers are cut after their last newline, the partial line being
+carried over to the next buffer, so no token is split.
+@param carry Data at offset origin preceding the pipe data.
+@param skip_timestamp Skip the timestamp the data starts with.
+@returns The time in force at the end.
+*/
+template<class Sink>
+static VCDTime decode_pipe(const VCDFile * fh, VCDInputPipe & pipe,
+                           std::string & carry, uint64_t origin,
+                           VCDTime time, VCDValue & vector_value,
+                           bool extend, Sink & sink, bool skip_timestamp) {
+    auto decode = [&](const char * p, const char * end, uint64_t at) {
+        sink.rebase(p, at);
+        if(skip_timestamp && p < end) {
+            for(p++; p < end && *p >= '0' && *p <= '9'; p++)
+                ;
+            skip_timestamp = false;
+        }
+        time = decode_values(fh, p, end, time, vector_value, extend, sink,
+                             false);
+    };
+    const char * data;
+    size_t       size;
+    uint64_t     at;
+    while(!sink.done() && pipe.next(data, size, at)) {
+        const char * first = (const char *)std::memchr(data, '\n', size);
+        if(!first) {
+            carry.append(data, size);
+            pipe.release();
+            continue;
+        }
+        const char * last = (const char *)memrchr(data, '\n', size);
+        carry.append(data, first + 1 - data);
+        decode(carry.data(), carry.data() + carry.size(), origin);
+        decode(first + 1, last + 1, at + (first + 1 - data));
+        carry.assign(last + 1, data + size - last - 1);
+        origin = at + (last + 1 - data);
+        pipe.release();
+    }
+    decode(carry.data(), carry.data() + carry.size(), origin);
+    return time;
+}
+
+bool VCDFileParser::open_pipe() {
+    this->pipe = VCDInputPipe::open(this->filepath);
+    if(!this->pipe)
+        return false;
+    this->pipe->start(0);
+    // Collect everything up to the $end of $enddefinitions for flex.
+    std::string & text = this->pipe_declarations;
+    text.clear();
+    const char * data;
+    size_t       size;
+    uint64_t     origin;
+    size_t       defs = std::string::npos;
+    while(this->pipe->next(data, size, origin)) {
+        size_t from = text.size() < 15 ? 0 : text.size() - 15;
+        text.append(data, size);
+        this->pipe->release();
+        if(defs == std::string::npos)
+            defs = text.find("$enddefinitions", from);
+        if(defs == std::string::npos)
+            continue;
+        size_t end = text.find("$end", std::max(from, defs + 15));
+        if(end != std::string::npos) {
+            this->pipe_pending.assign(text, end + 4, std::string::npos);
+            text.resize(end + 4);
+            break;
+        }
+    }
+    return true;
+}
+
+void VCDFileParser::close_pipe() {
+    delete this->pipe;
+    this->pipe = nullptr;
+    this->pipe_declarations.clear();
+    this->pipe_pending.clear();
+}
+
+bool VCDFileParser::scan_pipe() {
+    std::string carry;
+    uint64_t    origin = this->pipe_declarations.size();
+    carry.swap(this->pipe_pending);
+    if(this->resume_at) {
+        // The pipe restarts at the checkpoint timestamp, which is reported
+        // here along with the checkpoint values.
+        carry.clear();
+        origin = this->resume_at->offset;
+        this->pipe->start(origin);
+        this->current_time = this->resume_at->time;
+        add_timestamp(this->current_time);
+        for(size_t h = 0; h < this->fh->get_handle_count(); h++)
+            if(this->resume_at->known[h])
+                add_value(h, this->current_time, this->resume_at->values[h]);
+    }
+    if(this->index_out) {
+        this->index_out->handle_count = this->fh->get_handle_count();
+        this->index_out->set_source(this->filepath);
+        IndexSink sink(*this->index_out, nullptr);
+        this->current_time = decode_pipe(this->fh, *this->pipe, carry, origin,
+                                         this->current_time,
+                                         this->vector_value,
+                                         this->extend_vectors, sink, false);
+    } else {
+        ParserSink sink = {*this};
+        this->current_time = decode_pipe(this->fh, *this->pipe, carry, origin,
+                                         this->current_time,
+                                         this->vector_value,
+                                         this->extend_vectors, sink,
+                                         this->resume_at != nullptr);
+    }
+    return !this->pipe->failed();
+}
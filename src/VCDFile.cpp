@@ -0,0 +1,252 @@
+/*!
+@file
+@brief Definition of the VCDFile signal storage.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#include "VCDTypes.hpp"
+
+char * VCDArena::take_chunk(size_t bytes) {
+    // The heap is the fallback when the spill file cannot grow.
+    char * chunk = this->spill ? this->spill->map(bytes) : nullptr;
+    if(!chunk) {
+        chunk = new char[bytes];
+        this->chunks.push_back(chunk);
+    }
+    return chunk;
+}
+
+void * VCDArena::allocate(size_t bytes) {
+    bytes = (bytes + 7) & ~(size_t)7;
+    if(bytes > this->left) {
+        if(bytes > CHUNK_SIZE / 4) {
+            // Too big to share a chunk, keep the current one going.
+            return take_chunk(bytes);
+        }
+        this->next = take_chunk(CHUNK_SIZE);
+        this->left = CHUNK_SIZE;
+    }
+    void * p = this->next;
+    this->next += bytes;
+    this->left -= bytes;
+    return p;
+}
+
+VCDTime VCDTimeList::operator[](size_t i) const {
+    const Block   & block = this->blocks[i / BLOCK];
+    const uint8_t * p     = this->bytes.data() + block.offset;
+    VCDTime         time  = block.first;
+    for(size_t n = i % BLOCK; n > 0; n--)
+        time = decode(p, time);
+    return time;
+}
+
+size_t VCDTimeList::lower_bound(VCDTime time) const {
+    // The last block starting before time holds the answer, unless it is
+    // past its end and so the start of the next one.
+    auto it = std::lower_bound(this->blocks.begin(), this->blocks.end(), time,
+                               [](const Block & block, VCDTime t) {
+                                   return block.first < t;
+                               });
+    if(it == this->blocks.begin())
+        return 0;
+    size_t          i     = (it - this->blocks.begin() - 1) * BLOCK;
+    const uint8_t * p     = this->bytes.data() + it[-1].offset;
+    VCDTime         value = it[-1].first;
+    size_t          end   = std::min(i + BLOCK, this->count);
+    for(i++; i < end; i++) {
+        value = decode(p, value);
+        if(value >= time)
+            return i;
+    }
+    return end;
+}
+
+// Definitions for the constants that are bound to references.
+const uint32_t VCDSignalValues::MIN_BLOCK;
+const uint32_t VCDSignalValues::MAX_BLOCK;
+const uint32_t VCDSignalValues::DELTA_BYTES;
+
+void VCDSignalValues::push_back(VCDArena & arena, VCDTime time,
+                                const VCDValue & value) {
+    uint8_t   delta[VCDTimeList::MAX_DELTA];
+    uint8_t * delta_end = delta;
+    if(this->tail && this->tail->count < this->tail->capacity)
+        delta_end = VCDTimeList::encode(delta, this->tail->last, time);
+    uint32_t  delta_length = delta_end - delta;
+    if(!this->tail || this->tail->count == this->tail->capacity ||
+       this->tail->delta_size + delta_length > this->tail->delta_room) {
+        uint32_t capacity = MIN_BLOCK;
+        // Room for the deltas as long as the ones so far, with some slack.
+        uint32_t per_entry = DELTA_BYTES;
+        if(this->tail) {
+            capacity  = std::min(2 * this->tail->capacity, MAX_BLOCK);
+            per_entry = this->tail->delta_size / this->tail->count + 1;
+        }
+        uint32_t room = capacity * per_entry;
+        char * mem = (char *)arena.allocate(sizeof(VCDValueBlock) +
+                                            capacity * sizeof(VCDValue) +
+                                            room);
+        VCDValueBlock * block = (VCDValueBlock *)mem;
+        mem += sizeof(VCDValueBlock);
+        block->next       = nullptr;
+        block->count      = 0;
+        block->capacity   = capacity;
+        block->first      = time;
+        block->values     = (VCDValue *)mem;
+        block->deltas     = (uint8_t *)(mem + capacity * sizeof(VCDValue));
+        block->delta_size = 0;
+        block->delta_room = room;
+        if(this->tail)
+            this->tail->next = block;
+        else
+            this->head = block;
+        this->tail   = block;
+        delta_length = 0;
+    }
+    VCDValueBlock * block = this->tail;
+    std::memcpy(block->deltas + block->delta_size, delta, delta_length);
+    block->delta_size += delta_length;
+    block->last        = time;
+    VCDValue * slot = new (&block->values[block->count++]) VCDValue(VCD_0);
+    slot->place(value, arena);
+    this->count++;
+}
+
+VCDTimedValue VCDSignalValues::operator[](size_t i) const {
+    VCDValueBlock * block = this->head;
+    while(i >= block->count) {
+        i -= block->count;
+        block = block->next;
+    }
+    const uint8_t * p = block->deltas;
+    VCDTimedValue tv;
+    tv.time = block->first;
+    for(size_t n = i; n > 0; n--)
+        tv.time = VCDTimeList::decode(p, tv.time);
+    tv.value = &block->values[i];
+    return tv;
+}
+
+void VCDFile::add_scope(VCDScope * s) {
+    this->scopes.push_back(s);
+    this->paths.add_scope(s);
+}
+
+void VCDFile::add_signal(VCDSignal * s) {
+    this->signals.push_back(s);
+    s->handle = add_handle(s->hash);
+    VCDSignalSize & size = this->handle_sizes[s->handle];
+    size = std::max(size, s->size);
+    this->paths.add_signal(s);
+}
+
+void VCDFile::add_signal_value(VCDSignalHandle handle, VCDTime time,
+                               const VCDValue & value) {
+    if(this->compressed)
+        this->histories[handle]->push_back(time, value);
+    else
+        this->val_map[handle]->push_back(this->arena, time, value);
+}
+
+void VCDFile::append_values(VCDValueRange & range) {
+    this->times.append(range.times);
+    if(this->compressed) {
+        for(size_t h = 0; h < range.histories.size(); h++)
+            this->histories[h]->append(*range.histories[h]);
+        return;
+    }
+    for(size_t h = 0; h < range.values.size(); h++)
+        this->val_map[h]->append(range.values[h]);
+    this->arena.adopt(range.arena);
+}
+
+void VCDFile::set_compressed() {
+    this->compressed = true;
+    while(this->histories.size() < this->val_map.size())
+        this->histories.push_back(new VCDHistory());
+    this->expanded.resize(this->val_map.size(), false);
+}
+
+void VCDFile::shrink_histories() {
+    for(VCDHistory * history : this->histories)
+        history->shrink();
+}
+
+void VCDFile::expand(VCDSignalHandle handle) {
+    std::lock_guard<std::mutex> guard(this->expand_lock);
+    if(this->expanded[handle])
+        return;
+    this->histories[handle]->expand(*this->val_map[handle], this->arena);
+    this->expanded[handle] = true;
+}
+
+bool VCDFile::set_memory_budget(size_t budget,
+                                const std::string & directory) {
+    if(!this->spill)
+        this->spill = VCDSpill::create(budget, directory);
+    this->arena.set_spill(this->spill);
+    return this->spill != nullptr;
+}
+
+void VCDFile::select_handles(const std::vector<bool> & selected) {
+    for(VCDSignalHandle & handle : this->idcode_handles)
+        if(handle != VCD_HANDLE_NONE && !selected[handle])
+            handle = VCD_HANDLE_NONE;
+    for(auto it = this->long_idcode_handles.begin();
+        it != this->long_idcode_handles.end();) {
+        if(selected[it->second])
+            ++it;
+        else
+            it = this->long_idcode_handles.erase(it);
+    }
+}
+
+std::string VCDFile::signal_path(const VCDSignal * signal) {
+    std::string path = signal->reference;
+    for(VCDScope * scope = signal->scope;
+        scope && scope->type != VCD_SCOPE_ROOT; scope = scope->parent)
+        path = scope->name + "/" + path;
+    return path;
+}
+
+VCDSignalHandle VCDFile::get_long_handle(const char * id, size_t len) const {
+    if(this->long_idcode_handles.empty())
+        return VCD_HANDLE_NONE;
+    auto it = this->long_idcode_handles.find(VCDSignalHash(id, len));
+    if(it == this->long_idcode_handles.end())
+        return VCD_HANDLE_NONE;
+    return it->second;
+}
+
+VCDSignalHandle VCDFile::add_handle(const VCDSignalHash & hash) {
+    VCDSignalHandle handle = get_handle(hash);
+    if(handle != VCD_HANDLE_NONE)
+        return handle;
+
+    handle = this->val_map.size();
+    // Values will be populated later.
+    void * mem = this->arena.allocate(sizeof(VCDSignalValues));
+    this->val_map.push_back(new (mem) VCDSignalValues());
+    this->handle_sizes.push_back(0);
+    if(this->compressed) {
+        this->histories.push_back(new VCDHistory());
+        this->expanded.push_back(false);
+    }
+
+    // Keep the direct table proportional to the number of signals, codes
+    // from sparse or unusual allocators go to the map instead.
+    uint64_t code  = decode_idcode(hash.c_str(), hash.size());
+    uint64_t limit = 8 * (uint64_t)this->val_map.size() + 65536;
+    if(hash.size() <= IDCODE_DIGITS && code < limit) {
+        if(code >= this->idcode_handles.size())
+            this->idcode_handles.resize(code + 1, VCD_HANDLE_NONE);
+        this->idcode_handles[code] = handle;
+    } else {
+        this->long_idcode_handles[hash] = handle;
+    }
+    return handle;
+}
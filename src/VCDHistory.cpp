@@ -0,0 +1,351 @@
+/*!
+@file
+@brief Definition of the VCDHistory class.
+*/
+
+#include <algorithm>
+#include <cstring>
+
+#include "VCDTypes.hpp"
+
+// Definitions for the constants that are bound to references.
+const uint32_t VCDHistory::BLOCK;
+const uint32_t VCDHistory::DICTIONARY_SIZE;
+const uint32_t VCDHistory::NO_CODE;
+
+//! Zigzag time differences from this on do not fit next to a tag.
+static const uint64_t MAX_DIFF = (uint64_t)1 << 61;
+
+static void put_varint(std::vector<uint8_t> & out, uint64_t n) {
+    while(n >= 0x80) {
+        out.push_back((uint8_t)n | 0x80);
+        n >>= 7;
+    }
+    out.push_back((uint8_t)n);
+}
+
+static uint64_t get_varint(const uint8_t *& p) {
+    uint64_t n     = 0;
+    unsigned shift = 0;
+    uint8_t  byte;
+    do {
+        byte   = *p++;
+        n     |= (uint64_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while(byte >= 0x80);
+    return n;
+}
+
+//! Differences are zigzag encoded, as in VCDTimeList::encode.
+static uint64_t zigzag(uint64_t diff) {
+    return (diff << 1) ^ (uint64_t)((int64_t)diff >> 63);
+}
+
+static uint64_t unzigzag(uint64_t zz) {
+    return (zz >> 1) ^ (0 - (zz & 1));
+}
+
+//! Append the bytes of a plane of width bits, least significant first.
+static void put_plane(std::vector<uint8_t> & out, const uint64_t * words,
+                      VCDSignalSize width) {
+    size_t n = (width + 7) / 8;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    const uint8_t * b = (const uint8_t *)words;
+    out.insert(out.end(), b, b + n);
+#else
+    for(size_t i = 0; i < n; i++)
+        out.push_back((uint8_t)(words[i / 8] >> (8 * (i % 8))));
+#endif
+}
+
+//! Read a plane written by put_plane into cleared words.
+static const uint8_t * get_plane(const uint8_t * p, uint64_t * words,
+                                 VCDSignalSize width) {
+    size_t n = (width + 7) / 8;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    std::memcpy(words, p, n);
+#else
+    for(size_t i = 0; i < n; i++)
+        words[i / 8] |= (uint64_t)p[i] << (8 * (i % 8));
+#endif
+    return p + n;
+}
+
+//! Grow by a quarter at a time, doubling would waste up to half the bytes.
+static void reserve_more(std::vector<uint8_t> & bytes, size_t n) {
+    if(bytes.size() + n > bytes.capacity())
+        bytes.reserve(std::max(bytes.size() + n,
+                               bytes.capacity() + bytes.capacity() / 4 + 16));
+}
+
+uint32_t VCDHistory::intern(unsigned tag, uint64_t offset, bool & added) {
+    added = false;
+    if(!this->dictionary) {
+        this->dictionary = new Dictionary;
+        this->dictionary->slots.assign(16, 0);
+    }
+    Dictionary & dict = *this->dictionary;
+    uint32_t hash = 2166136261u ^ tag;
+    for(uint8_t byte : this->payload)
+        hash = (hash ^ byte) * 16777619u;
+    size_t mask = dict.slots.size() - 1;
+    size_t i    = hash & mask;
+    for(; dict.slots[i]; i = (i + 1) & mask) {
+        uint32_t code = dict.slots[i] - 1;
+        if(dict.hashes[code] != hash)
+            continue;
+        const uint8_t * p = this->bytes.data() + dict.offsets[code];
+        if((get_varint(p) & 7) == tag &&
+           (size_t)(skip(p, tag) - p) == this->payload.size() &&
+           std::memcmp(p, this->payload.data(), this->payload.size()) == 0)
+            return code;
+    }
+    if(dict.offsets.size() >= DICTIONARY_SIZE)
+        return NO_CODE;
+    uint32_t code = dict.offsets.size();
+    dict.offsets.push_back(offset);
+    dict.hashes.push_back(hash);
+    dict.slots[i] = code + 1;
+    if(2 * dict.offsets.size() > dict.slots.size()) {
+        std::vector<uint16_t> slots(2 * dict.slots.size(), 0);
+        mask = slots.size() - 1;
+        for(uint32_t c = 0; c < dict.offsets.size(); c++) {
+            size_t j = dict.hashes[c] & mask;
+            while(slots[j])
+                j = (j + 1) & mask;
+            slots[j] = c + 1;
+        }
+        dict.slots.swap(slots);
+    }
+    added = true;
+    return code;
+}
+
+const uint8_t * VCDHistory::skip(const uint8_t * p, unsigned tag) const {
+    switch(tag) {
+    case TAG_REF:
+        get_varint(p);
+        return p;
+    case TAG_REAL:
+        return p + sizeof(VCDReal);
+    case TAG_KNOWN:
+    case TAG_VECTOR: {
+        size_t n = (get_varint(p) + 7) / 8;
+        return p + (tag == TAG_VECTOR ? 2 * n : n);
+    }
+    default:
+        return p;
+    }
+}
+
+void VCDHistory::decode(const uint8_t * p, unsigned tag,
+                        VCDValue & value) const {
+    if(tag < TAG_REF) {
+        value = VCDValue((VCDBit)(tag - TAG_BIT));
+        return;
+    }
+    if(tag == TAG_REF) {
+        uint32_t code = get_varint(p);
+        p   = this->bytes.data() + this->dictionary->offsets[code];
+        tag = get_varint(p) & 7;
+    }
+    if(tag == TAG_REAL) {
+        VCDReal real;
+        std::memcpy(&real, p, sizeof(real));
+        value = VCDValue(real);
+        return;
+    }
+    if(value.get_type() != VCD_VECTOR)
+        value = VCDValue(VCDBitVector());
+    VCDBitVector * vec   = value.get_value_vector();
+    VCDSignalSize  width = get_varint(p);
+    vec->clear(width);
+    p = get_plane(p, vec->value_words(), width);
+    if(tag == TAG_VECTOR)
+        get_plane(p, vec->xz_words(), width);
+}
+
+void VCDHistory::push_back(VCDTime time, const VCDValue & value) {
+    unsigned tag;
+    this->payload.clear();
+    switch(value.get_type()) {
+    case VCD_SCALAR:
+        tag = TAG_BIT + value.get_value_bit();
+        break;
+    case VCD_REAL: {
+        VCDReal real = value.get_value_real();
+        const uint8_t * b = (const uint8_t *)&real;
+        this->payload.assign(b, b + sizeof(real));
+        tag = TAG_REAL;
+        break;
+    }
+    default: {
+        const VCDBitVector * vec = value.get_value_vector();
+        tag = vec->is_known() ? TAG_KNOWN : TAG_VECTOR;
+        put_varint(this->payload, vec->size());
+        put_plane(this->payload, vec->value_words(), vec->size());
+        if(tag == TAG_VECTOR)
+            put_plane(this->payload, vec->xz_words(), vec->size());
+        break;
+    }
+    }
+
+    // A value new to the dictionary is written out in full at this offset.
+    bool     added = false;
+    uint32_t code  = tag > TAG_REF ?
+        intern(tag, this->bytes.size(), added) : NO_CODE;
+    if(this->count) {
+        bool same;
+        if(tag < TAG_REF)
+            same = tag == this->last_tag;
+        else if(code != NO_CODE)
+            same = code == this->last_code;
+        else
+            same = this->last_code == NO_CODE && tag == this->last_tag &&
+                   this->bytes.size() - this->last_payload ==
+                   this->payload.size() &&
+                   std::memcmp(this->bytes.data() + this->last_payload,
+                               this->payload.data(),
+                               this->payload.size()) == 0;
+        if(same)
+            return;
+    }
+
+    uint64_t zz = zigzag(time - this->last);
+    if(this->count == 0 || this->block_count == BLOCK || zz >= MAX_DIFF) {
+        Block block = {time, this->bytes.size(), this->count};
+        this->blocks.push_back(block);
+        this->block_count = 0;
+        zz = 0;
+    }
+    unsigned stored = code != NO_CODE && !added ? TAG_REF : tag;
+    reserve_more(this->bytes, 2 * 10 + this->payload.size());
+    put_varint(this->bytes, zz << 3 | stored);
+    this->last_payload = this->bytes.size();
+    if(stored == TAG_REF)
+        put_varint(this->bytes, code);
+    else
+        this->bytes.insert(this->bytes.end(), this->payload.begin(),
+                           this->payload.end());
+    this->count++;
+    this->block_count++;
+    this->last      = time;
+    this->last_tag  = tag;
+    this->last_code = code;
+}
+
+bool VCDHistory::value_at(VCDTime time, VCDValue & value,
+                          VCDTime * since) const {
+    auto it = std::upper_bound(this->blocks.begin(), this->blocks.end(),
+                               time, [](VCDTime t, const Block & block) {
+                                   return t < block.first;
+                               });
+    if(it == this->blocks.begin())
+        return false;
+    const uint8_t * base = this->bytes.data();
+    const uint8_t * p    = base + (it - 1)->offset;
+    const uint8_t * end  = it == this->blocks.end() ?
+                           base + this->bytes.size() : base + it->offset;
+    // The first change of a block has no difference, so it lands on first.
+    VCDTime         t     = (it - 1)->first;
+    const uint8_t * found = nullptr;
+    unsigned        tag   = 0;
+    VCDTime         when  = 0;
+    while(p < end) {
+        uint64_t head = get_varint(p);
+        t += unzigzag(head >> 3);
+        if(t > time)
+            break;
+        found = p;
+        tag   = head & 7;
+        when  = t;
+        p     = skip(p, tag);
+    }
+    decode(found, tag, value);
+    if(since)
+        *since = when;
+    return true;
+}
+
+VCDHistory::const_iterator VCDHistory::lower_bound(VCDTime time) const {
+    // Changes at time may start in the block before the first one at time.
+    auto it = std::lower_bound(this->blocks.begin(), this->blocks.end(),
+                               time, [](const Block & block, VCDTime t) {
+                                   return block.first < t;
+                               });
+    if(it == this->blocks.begin())
+        return begin();
+    --it;
+    const_iterator found(this, it->index, it - this->blocks.begin());
+    while(found.index < this->count && found.time < time)
+        ++found;
+    return found;
+}
+
+void VCDHistory::expand(VCDSignalValues & values, VCDArena & arena) const {
+    for(const_iterator it = begin(); it != end(); ++it) {
+        VCDTimedValue tv = *it;
+        values.push_back(arena, tv.time, *tv.value);
+    }
+}
+
+void VCDHistory::append(const VCDHistory & other) {
+    // Dictionary indices are local to a history, so the changes are encoded
+    // again, which also drops a repeat at the seam.
+    for(const_iterator it = other.begin(); it != other.end(); ++it) {
+        VCDTimedValue tv = *it;
+        push_back(tv.time, *tv.value);
+    }
+}
+
+void VCDHistory::shrink() {
+    this->bytes.shrink_to_fit();
+    this->blocks.shrink_to_fit();
+    this->payload.clear();
+    this->payload.shrink_to_fit();
+}
+
+size_t VCDHistory::memory() const {
+    size_t bytes = sizeof(*this) + this->bytes.capacity() +
+                   this->blocks.capacity() * sizeof(Block) +
+                   this->payload.capacity();
+    if(this->dictionary)
+        bytes += sizeof(Dictionary) +
+                 this->dictionary->offsets.capacity() * sizeof(uint64_t) +
+                 this->dictionary->hashes.capacity() * sizeof(uint32_t) +
+                 this->dictionary->slots.capacity() * sizeof(uint16_t);
+    return bytes;
+}
+
+VCDHistory::const_iterator::const_iterator(const VCDHistory * history,
+                                           size_t index) :
+    history(history), index(index), block(0), next(nullptr), time(0),
+    value(VCD_X) {
+    if(index == 0 && history->count) {
+        this->next = history->bytes.data();
+        load();
+    }
+}
+
+VCDHistory::const_iterator::const_iterator(const VCDHistory * history,
+                                           size_t index, size_t block) :
+    history(history), index(index), block(block), next(nullptr), time(0),
+    value(VCD_X) {
+    this->next = history->bytes.data() + history->blocks[block].offset;
+    load();
+}
+
+void VCDHistory::const_iterator::load() {
+    const std::vector<Block> & blocks = this->history->blocks;
+    uint64_t offset = this->next - this->history->bytes.data();
+    if(this->block + 1 < blocks.size() &&
+       blocks[this->block + 1].offset == offset)
+        this->block++;
+    if(blocks[this->block].offset == offset)
+        this->time = blocks[this->block].first;
+    uint64_t head = get_varint(this->next);
+    unsigned tag  = head & 7;
+    this->time += unzigzag(head >> 3);
+    this->history->decode(this->next, tag, this->value);
+    this->next = this->history->skip(this->next, tag);
+}
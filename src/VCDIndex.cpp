@@ -0,0 +1,208 @@
+/*!
+@file
+@brief Definition of the VCDCheckpointIndex class.
+@details A saved index is a header followed by each checkpoint: its time
+and offset, then one record per handle. A record is a type byte, 0xff for a
+handle without a value, followed by the bit, the real, or the width and the
+two planes of a vector.
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+#include "VCDTypes.hpp"
+
+//! Identifies an index file.
+static const char INDEX_MAGIC[8] = {'V', 'C', 'D', 'I', 'N', 'D', 'E', 'X'};
+//! Bumped whenever the layout changes.
+static const uint32_t INDEX_VERSION = 2;
+//! Record type of a handle without a value.
+static const uint8_t INDEX_UNKNOWN = 0xff;
+
+//! Start of an index file.
+typedef struct {
+    char     magic[8];         //!< INDEX_MAGIC.
+    uint32_t version;          //!< INDEX_VERSION.
+    uint32_t reserved;         //!< Zero.
+    uint64_t source_size;      //!< VCDCheckpointIndex::source_size.
+    int64_t  source_mtime;     //!< VCDCheckpointIndex::source_mtime.
+    int64_t  source_mtime_ns;  //!< VCDCheckpointIndex::source_mtime_ns.
+    VCDTime  interval;         //!< VCDCheckpointIndex::interval.
+    uint64_t handle_count;     //!< Records in each checkpoint.
+    uint64_t checkpoint_count; //!< Number of checkpoints.
+} VCDIndexHeader;
+
+void VCDCheckpointIndex::add(VCDTime time, uint64_t offset,
+                             const VCDValue * values, const uint8_t * known) {
+    VCDCheckpoint cp;
+    cp.time   = time;
+    cp.offset = offset;
+    cp.values = (VCDValue *)this->arena.allocate(this->handle_count *
+                                                 sizeof(VCDValue));
+    cp.known  = (uint8_t *)this->arena.allocate(this->handle_count);
+    for(size_t h = 0; h < this->handle_count; h++) {
+        new (&cp.values[h]) VCDValue(VCD_X);
+        cp.known[h] = known[h];
+        if(known[h])
+            cp.values[h].place(values[h], this->arena);
+    }
+    this->checkpoints.push_back(cp);
+}
+
+const VCDCheckpoint * VCDCheckpointIndex::find(VCDTime time) const {
+    auto it = std::upper_bound(this->checkpoints.begin(),
+                               this->checkpoints.end(), time,
+                               [](VCDTime t, const VCDCheckpoint & cp) {
+                                   return t < cp.time;
+                               });
+    if(it == this->checkpoints.begin())
+        return nullptr;
+    return &*(it - 1);
+}
+
+bool VCDCheckpointIndex::set_source(const std::string & sourcepath) {
+    struct stat st;
+    if(stat(sourcepath.c_str(), &st) != 0)
+        return false;
+    this->source_size     = st.st_size;
+    this->source_mtime    = st.st_mtim.tv_sec;
+    this->source_mtime_ns = st.st_mtim.tv_nsec;
+    return true;
+}
+
+bool VCDCheckpointIndex::matches(const std::string & sourcepath) const {
+    struct stat st;
+    return stat(sourcepath.c_str(), &st) == 0 &&
+           this->source_size     == (uint64_t)st.st_size &&
+           this->source_mtime    == st.st_mtim.tv_sec &&
+           this->source_mtime_ns == st.st_mtim.tv_nsec;
+}
+
+bool VCDCheckpointIndex::write(const std::string & path) const {
+    FILE * out = std::fopen(path.c_str(), "wb");
+    if(!out)
+        return false;
+    VCDIndexHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version          = INDEX_VERSION;
+    header.source_size      = this->source_size;
+    header.source_mtime     = this->source_mtime;
+    header.source_mtime_ns  = this->source_mtime_ns;
+    header.interval         = this->interval;
+    header.handle_count     = this->handle_count;
+    header.checkpoint_count = this->checkpoints.size();
+    bool ok = std::fwrite(&header, sizeof(header), 1, out) == 1;
+    for(const VCDCheckpoint & cp : this->checkpoints) {
+        ok = ok && std::fwrite(&cp.time, sizeof(cp.time), 1, out) == 1;
+        ok = ok && std::fwrite(&cp.offset, sizeof(cp.offset), 1, out) == 1;
+        for(size_t h = 0; ok && h < this->handle_count; h++) {
+            const VCDValue & value = cp.values[h];
+            uint8_t type = cp.known[h] ? value.get_type() : INDEX_UNKNOWN;
+            ok = std::fputc(type, out) != EOF;
+            if(!cp.known[h])
+                continue;
+            if(type == VCD_SCALAR) {
+                ok = ok && std::fputc(value.get_value_bit(), out) != EOF;
+            } else if(type == VCD_REAL) {
+                VCDReal real = value.get_value_real();
+                ok = ok && std::fwrite(&real, sizeof(real), 1, out) == 1;
+            } else {
+                const VCDBitVector * vec = value.get_value_vector();
+                uint32_t width = vec->size();
+                ok = ok && std::fwrite(&width, sizeof(width), 1, out) == 1;
+                ok = ok && std::fwrite(vec->value_words(), sizeof(uint64_t),
+                                       vec->words(), out) == vec->words();
+                ok = ok && std::fwrite(vec->xz_words(), sizeof(uint64_t),
+                                       vec->words(), out) == vec->words();
+            }
+        }
+    }
+    ok = (std::fclose(out) == 0) && ok;
+    if(!ok)
+        std::remove(path.c_str());
+    return ok;
+}
+
+bool VCDCheckpointIndex::read(const std::string & path) {
+    FILE * in = std::fopen(path.c_str(), "rb");
+    if(!in)
+        return false;
+    struct stat st;
+    VCDIndexHeader header;
+    std::memset(&header, 0, sizeof(header));
+    bool ok = fstat(fileno(in), &st) == 0 &&
+        std::fread(&header, sizeof(header), 1, in) == 1 &&
+        std::memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 &&
+        header.version == INDEX_VERSION;
+    // Every record takes at least its type byte and every checkpoint its
+    // time and offset as well, so the counts are bounded by what is left
+    // before anything is allocated for them.
+    uint64_t left = ok ? st.st_size - sizeof(header) : 0;
+    ok = ok && header.handle_count <= left &&
+         header.checkpoint_count <=
+             left / (sizeof(VCDTime) + sizeof(uint64_t) + header.handle_count);
+
+    // Built aside, so a bad file leaves this index as it was.
+    VCDCheckpointIndex index;
+    index.source_size     = header.source_size;
+    index.source_mtime    = header.source_mtime;
+    index.source_mtime_ns = header.source_mtime_ns;
+    index.interval        = header.interval;
+    index.handle_count    = ok ? header.handle_count : 0;
+    std::vector<VCDValue> values(index.handle_count, VCDValue(VCD_X));
+    std::vector<uint8_t>  known(values.size());
+    VCDBitVector          vec;
+    for(uint64_t i = 0; ok && i < header.checkpoint_count; i++) {
+        VCDTime  time;
+        uint64_t offset;
+        ok = std::fread(&time, sizeof(time), 1, in) == 1 &&
+             std::fread(&offset, sizeof(offset), 1, in) == 1;
+        for(size_t h = 0; ok && h < values.size(); h++) {
+            int type = std::fgetc(in);
+            known[h] = type != INDEX_UNKNOWN;
+            if(type == VCD_SCALAR) {
+                int bit = std::fgetc(in);
+                ok = bit != EOF && bit <= VCD_Z;
+                values[h] = VCDValue((VCDBit)bit);
+            } else if(type == VCD_REAL) {
+                VCDReal real;
+                ok = std::fread(&real, sizeof(real), 1, in) == 1;
+                values[h] = VCDValue(real);
+            } else if(type == VCD_VECTOR) {
+                uint32_t width;
+                long     at = std::ftell(in);
+                ok = std::fread(&width, sizeof(width), 1, in) == 1 && at >= 0;
+                // Both planes have to fit in the rest of the file.
+                uint64_t rest = ok ? st.st_size - at - sizeof(width) : 0;
+                ok = ok && ((uint64_t)width + 63) / 64 <=
+                           rest / (2 * sizeof(uint64_t));
+                if(!ok)
+                    break;
+                vec = VCDBitVector(width);
+                ok = std::fread(vec.value_words(), sizeof(uint64_t),
+                                vec.words(), in) == vec.words() &&
+                     std::fread(vec.xz_words(), sizeof(uint64_t),
+                                vec.words(), in) == vec.words();
+                values[h] = VCDValue(vec);
+            } else {
+                ok = type == INDEX_UNKNOWN;
+            }
+        }
+        if(ok)
+            index.add(time, offset, values.data(), known.data());
+    }
+    std::fclose(in);
+    if(!ok)
+        return false;
+    this->arena.adopt(index.arena);
+    this->checkpoints.swap(index.checkpoints);
+    this->handle_count    = index.handle_count;
+    this->interval        = index.interval;
+    this->source_size     = index.source_size;
+    this->source_mtime    = index.source_mtime;
+    this->source_mtime_ns = index.source_mtime_ns;
+    return true;
+}
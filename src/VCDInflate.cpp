@@ -0,0 +1,371 @@
+/*!
+@file
+@brief Definition of the VCDInputPipe class.
+@details gzip files are read with zlib, concatenated members included. xz
+files are read with liblzma; when a file holds a single stream its index is
+loaded so that a restart can begin at the block holding the offset.
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <lzma.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "VCDTypes.hpp"
+
+//! Compressed bytes read from the file at a time.
+static const size_t INPUT_SIZE = 1 << 20;
+
+struct VCDInputPipe::Codec {
+    enum Format { GZIP, XZ } format;
+
+    z_stream        z;
+    bool            z_ready;
+    //! True once a gzip member has ended and no other one has begun.
+    bool            z_ended;
+
+    lzma_stream     x;
+    //! Block index of a single stream xz file, or nullptr.
+    lzma_index    * index;
+    lzma_index_iter iter;
+    lzma_check      check;
+    //! True when decoding the blocks of index one at a time.
+    bool            blocks;
+    lzma_block      block;
+    lzma_filter     filters[LZMA_FILTERS_MAX + 1];
+
+    uint8_t       * input;
+    bool            eof;
+    //! True once there is no more output.
+    bool            done;
+
+    Codec(Format format) : format(format), z_ready(false), z_ended(false),
+        x(LZMA_STREAM_INIT), index(nullptr), check(LZMA_CHECK_NONE),
+        blocks(false), input(new uint8_t[INPUT_SIZE]), eof(false),
+        done(false) {
+        std::memset(&this->z, 0, sizeof(this->z));
+        std::memset(&this->block, 0, sizeof(this->block));
+        this->filters[0].id = LZMA_VLI_UNKNOWN;
+    }
+    ~Codec() {
+        if(this->z_ready)
+            inflateEnd(&this->z);
+        lzma_end(&this->x);
+        free_filters();
+        if(this->index)
+            lzma_index_end(this->index, nullptr);
+        delete [] this->input;
+    }
+
+    //! Release the options of the filter chain of the last block header.
+    void free_filters() {
+        for(int i = 0; this->filters[i].id != LZMA_VLI_UNKNOWN; i++)
+            std::free(this->filters[i].options);
+        this->filters[0].id = LZMA_VLI_UNKNOWN;
+    }
+
+    //! Load the index of in if it is a single xz stream.
+    void load_index(FILE * in);
+    //! Start the decoder for the block iter points at.
+    bool open_block(FILE * in);
+    /*!
+    @brief Restart so that output begins at or before offset.
+    @param position Set to the offset of the first output byte.
+    @returns false if the file cannot be read.
+    */
+    bool reset(FILE * in, uint64_t offset, uint64_t & position);
+    /*!
+    @brief Decompress up to size bytes into out.
+    @returns The number of bytes, 0 once there are no more.
+    */
+    size_t read(FILE * in, char * out, size_t size, bool & error);
+
+    //! Refill the input buffer once it is empty. @returns false on errors.
+    bool fill(FILE * in, const uint8_t *& next_in, size_t & avail_in) {
+        if(avail_in || this->eof)
+            return true;
+        avail_in = std::fread(this->input, 1, INPUT_SIZE, in);
+        next_in  = this->input;
+        this->eof = avail_in == 0;
+        return !std::ferror(in);
+    }
+};
+
+void VCDInputPipe::Codec::load_index(FILE * in) {
+    struct stat st;
+    uint8_t footer[LZMA_STREAM_HEADER_SIZE];
+    lzma_stream_flags flags;
+    if(fstat(fileno(in), &st) != 0 ||
+       st.st_size < 2 * LZMA_STREAM_HEADER_SIZE ||
+       std::fseek(in, -LZMA_STREAM_HEADER_SIZE, SEEK_END) != 0 ||
+       std::fread(footer, 1, sizeof(footer), in) != sizeof(footer) ||
+       lzma_stream_footer_decode(&flags, footer) != LZMA_OK ||
+       flags.backward_size > (lzma_vli)st.st_size)
+        return;
+    std::vector<uint8_t> buffer(flags.backward_size);
+    uint64_t memlimit = UINT64_MAX;
+    size_t   pos = 0;
+    if(std::fseek(in, -(long)(LZMA_STREAM_HEADER_SIZE + buffer.size()),
+                  SEEK_END) != 0 ||
+       std::fread(buffer.data(), 1, buffer.size(), in) != buffer.size() ||
+       lzma_index_buffer_decode(&this->index, &memlimit, nullptr,
+                                buffer.data(), &pos, buffer.size()) != LZMA_OK)
+        return;
+    // The index only covers the last stream, so concatenated files are
+    // decoded from the start.
+    if(lzma_index_file_size(this->index) != (lzma_vli)st.st_size) {
+        lzma_index_end(this->index, nullptr);
+        this->index = nullptr;
+        return;
+    }
+    this->check = flags.check;
+}
+
+bool VCDInputPipe::Codec::open_block(FILE * in) {
+    uint8_t header[LZMA_BLOCK_HEADER_SIZE_MAX];
+    if(std::fseek(in, this->iter.block.compressed_file_offset, SEEK_SET) != 0 ||
+       std::fread(header, 1, 1, in) != 1)
+        return false;
+    free_filters();
+    std::memset(&this->block, 0, sizeof(this->block));
+    this->block.version     = 1;
+    this->block.check       = this->check;
+    this->block.filters     = this->filters;
+    this->block.header_size = lzma_block_header_size_decode(header[0]);
+    if(std::fread(header + 1, 1, this->block.header_size - 1, in) !=
+           this->block.header_size - 1 ||
+       lzma_block_header_decode(&this->block, nullptr, header) != LZMA_OK ||
+       lzma_block_decoder(&this->x, &this->block) != LZMA_OK)
+        return false;
+    this->x.avail_in = 0;
+    this->eof = false;
+    return true;
+}
+
+bool VCDInputPipe::Codec::reset(FILE * in, uint64_t offset,
+                                uint64_t & position) {
+    this->done   = false;
+    this->eof    = false;
+    this->blocks = false;
+    position     = 0;
+    if(this->format == GZIP) {
+        if(this->z_ready)
+            inflateEnd(&this->z);
+        std::memset(&this->z, 0, sizeof(this->z));
+        this->z_ready = inflateInit2(&this->z, 15 + 32) == Z_OK;
+        this->z_ended = false;
+        return this->z_ready && std::fseek(in, 0, SEEK_SET) == 0;
+    }
+    if(this->index && offset > 0) {
+        lzma_index_iter_init(&this->iter, this->index);
+        if(lzma_index_iter_locate(&this->iter, offset)) {
+            // Past the end, there is nothing to deliver.
+            this->done = true;
+            position   = offset;
+            return true;
+        }
+        this->blocks = true;
+        position = this->iter.block.uncompressed_file_offset;
+        return open_block(in);
+    }
+    this->x.avail_in = 0;
+    return lzma_stream_decoder(&this->x, UINT64_MAX,
+                               LZMA_CONCATENATED) == LZMA_OK &&
+           std::fseek(in, 0, SEEK_SET) == 0;
+}
+
+size_t VCDInputPipe::Codec::read(FILE * in, char * out, size_t size,
+                                 bool & error) {
+    if(this->done)
+        return 0;
+    if(this->format == GZIP) {
+        this->z.next_out  = (Bytef *)out;
+        this->z.avail_out = size;
+        while(this->z.avail_out) {
+            const uint8_t * next_in  = this->z.next_in;
+            size_t          avail_in = this->z.avail_in;
+            if(!fill(in, next_in, avail_in)) {
+                error = true;
+                break;
+            }
+            this->z.next_in  = (Bytef *)next_in;
+            this->z.avail_in = avail_in;
+            // Running out of input is only fine between members.
+            if(this->eof && this->z_ended)
+                break;
+            int r = inflate(&this->z, Z_NO_FLUSH);
+            if(r == Z_STREAM_END) {
+                this->z_ended = true;
+                inflateReset(&this->z);
+            } else if(r == Z_OK) {
+                this->z_ended = false;
+            } else {
+                error = true;
+                break;
+            }
+        }
+        if(this->z.avail_out)
+            this->done = true;
+        return size - this->z.avail_out;
+    }
+
+    this->x.next_out  = (uint8_t *)out;
+    this->x.avail_out = size;
+    while(this->x.avail_out) {
+        if(!fill(in, this->x.next_in, this->x.avail_in)) {
+            error = true;
+            break;
+        }
+        lzma_ret r = lzma_code(&this->x, this->eof ? LZMA_FINISH : LZMA_RUN);
+        if(r == LZMA_STREAM_END) {
+            if(this->blocks &&
+               !lzma_index_iter_next(&this->iter, LZMA_INDEX_ITER_BLOCK)) {
+                if(!open_block(in)) {
+                    error = true;
+                    break;
+                }
+                continue;
+            }
+            break;
+        }
+        if(r != LZMA_OK) {
+            error = true;
+            break;
+        }
+    }
+    if(this->x.avail_out)
+        this->done = true;
+    return size - this->x.avail_out;
+}
+
+VCDInputPipe * VCDInputPipe::open(const std::string & filepath) {
+    static const uint8_t GZIP_MAGIC[2] = {0x1f, 0x8b};
+    static const uint8_t XZ_MAGIC[6]   = {0xfd, '7', 'z', 'X', 'Z', 0x00};
+    FILE * in = std::fopen(filepath.c_str(), "rb");
+    if(!in)
+        return nullptr;
+    uint8_t magic[6];
+    size_t  n = std::fread(magic, 1, sizeof(magic), in);
+    Codec * codec = nullptr;
+    if(n >= sizeof(GZIP_MAGIC) &&
+       std::memcmp(magic, GZIP_MAGIC, sizeof(GZIP_MAGIC)) == 0) {
+        codec = new Codec(Codec::GZIP);
+    } else if(n == sizeof(XZ_MAGIC) &&
+              std::memcmp(magic, XZ_MAGIC, sizeof(XZ_MAGIC)) == 0) {
+        codec = new Codec(Codec::XZ);
+        codec->load_index(in);
+    } else {
+        std::fclose(in);
+        return nullptr;
+    }
+    return new VCDInputPipe(in, codec);
+}
+
+VCDInputPipe::VCDInputPipe(FILE * in, Codec * codec) : in(in), codec(codec),
+    filled(0), taken(0), released(0), start_offset(0), finished(true),
+    stopping(false), error(false) {
+    for(unsigned i = 0; i < BUFFER_COUNT; i++)
+        this->buffers[i] = new char[BUFFER_SIZE];
+}
+
+VCDInputPipe::~VCDInputPipe() {
+    stop();
+    delete this->codec;
+    std::fclose(this->in);
+    for(unsigned i = 0; i < BUFFER_COUNT; i++)
+        delete [] this->buffers[i];
+}
+
+void VCDInputPipe::start(uint64_t offset) {
+    stop();
+    this->filled       = 0;
+    this->taken        = 0;
+    this->released     = 0;
+    this->start_offset = offset;
+    this->finished     = false;
+    this->stopping     = false;
+    this->error        = false;
+    this->worker = std::thread(&VCDInputPipe::run, this);
+}
+
+void VCDInputPipe::stop() {
+    if(!this->worker.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->stopping = true;
+    }
+    this->changed.notify_all();
+    this->worker.join();
+}
+
+void VCDInputPipe::run() {
+    uint64_t position;
+    bool failed = !this->codec->reset(this->in, this->start_offset, position);
+    while(!failed) {
+        unsigned slot;
+        {
+            std::unique_lock<std::mutex> guard(this->lock);
+            this->changed.wait(guard, [this] {
+                return this->stopping ||
+                       this->filled - this->released < BUFFER_COUNT;
+            });
+            if(this->stopping)
+                return;
+            slot = this->filled % BUFFER_COUNT;
+        }
+        char * buffer = this->buffers[slot];
+        size_t size = 0;
+        while(size < BUFFER_SIZE) {
+            size_t got = this->codec->read(this->in, buffer + size,
+                                           BUFFER_SIZE - size, failed);
+            if(got == 0)
+                break;
+            size += got;
+        }
+        // Drop whatever precedes the requested offset.
+        size_t begin = 0;
+        if(this->start_offset > position)
+            begin = std::min<uint64_t>(this->start_offset - position, size);
+        position += size;
+        if(begin < size) {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->begins[slot]  = begin;
+            this->sizes[slot]   = size - begin;
+            this->origins[slot] = position - size + begin;
+            this->filled++;
+            this->changed.notify_all();
+        }
+        if(size < BUFFER_SIZE)
+            break;
+    }
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->finished = true;
+    this->error    = failed;
+    this->changed.notify_all();
+}
+
+bool VCDInputPipe::next(const char *& data, size_t & size,
+                        uint64_t & origin) {
+    std::unique_lock<std::mutex> guard(this->lock);
+    this->changed.wait(guard, [this] {
+        return this->filled > this->taken || this->finished;
+    });
+    if(this->filled == this->taken)
+        return false;
+    unsigned slot = this->taken++ % BUFFER_COUNT;
+    data   = this->buffers[slot] + this->begins[slot];
+    size   = this->sizes[slot];
+    origin = this->origins[slot];
+    return true;
+}
+
+void VCDInputPipe::release() {
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->released++;
+    }
+    this->changed.notify_all();
+}
@@ -0,0 +1,260 @@
+/*!
+@file
+@brief Definition of the VCDPathIndex class.
+*/
+
+#include <algorithm>
+#include <cstring>
+
+#include "VCDTypes.hpp"
+
+const VCDPathIndex::Node VCDPathIndex::NONE;
+
+//! Initial size of the hash tables, which are kept at most half full.
+static const size_t INITIAL_SLOTS = 64;
+
+VCDPathIndex::VCDPathIndex() :
+    name_slots(INITIAL_SLOTS, 0), child_slots(INITIAL_SLOTS, 0),
+    name_count(0) {
+    Entry root = {NONE, add_name("", 0), NONE, NONE, NONE, nullptr, nullptr};
+    this->nodes.push_back(root);
+}
+
+uint32_t VCDPathIndex::hash_name(const char * name, size_t length) {
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < length; i++)
+        h = (h ^ (uint8_t)name[i]) * 16777619u;
+    return h;
+}
+
+uint32_t VCDPathIndex::hash_child(Node parent, uint32_t name) {
+    uint64_t key = (uint64_t)parent << 32 | name;
+    return (key * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+uint32_t VCDPathIndex::find_name(const char * name, size_t length) const {
+    size_t mask = this->name_slots.size() - 1;
+    for(size_t i = hash_name(name, length) & mask;; i = (i + 1) & mask) {
+        uint32_t slot = this->name_slots[i];
+        if(slot == 0)
+            return NONE;
+        const char * known = &this->names[slot - 1];
+        if(std::strncmp(known, name, length) == 0 && known[length] == 0)
+            return slot - 1;
+    }
+}
+
+uint32_t VCDPathIndex::add_name(const char * name, size_t length) {
+    uint32_t offset = find_name(name, length);
+    if(offset != NONE)
+        return offset;
+    offset = this->names.size();
+    this->names.insert(this->names.end(), name, name + length);
+    this->names.push_back(0);
+    size_t mask = this->name_slots.size() - 1;
+    size_t i    = hash_name(name, length) & mask;
+    while(this->name_slots[i])
+        i = (i + 1) & mask;
+    this->name_slots[i] = offset + 1;
+    if(++this->name_count * 2 > this->name_slots.size())
+        grow_names();
+    return offset;
+}
+
+void VCDPathIndex::grow_names() {
+    std::vector<uint32_t> slots(2 * this->name_slots.size(), 0);
+    size_t mask = slots.size() - 1;
+    for(uint32_t slot : this->name_slots) {
+        if(!slot)
+            continue;
+        const char * name = &this->names[slot - 1];
+        size_t i = hash_name(name, std::strlen(name)) & mask;
+        while(slots[i])
+            i = (i + 1) & mask;
+        slots[i] = slot;
+    }
+    this->name_slots.swap(slots);
+}
+
+void VCDPathIndex::grow_children() {
+    std::vector<uint32_t> slots(2 * this->child_slots.size(), 0);
+    size_t mask = slots.size() - 1;
+    for(Node node : this->child_slots) {
+        if(!node)
+            continue;
+        const Entry & entry = this->nodes[node];
+        size_t i = hash_child(entry.parent, entry.name) & mask;
+        while(slots[i])
+            i = (i + 1) & mask;
+        slots[i] = node;
+    }
+    this->child_slots.swap(slots);
+}
+
+VCDPathIndex::Node VCDPathIndex::add_child(Node parent,
+                                           const std::string & name) {
+    uint32_t offset = add_name(name.data(), name.length());
+    // The root is never a child, so node 0 marks an empty slot.
+    size_t mask = this->child_slots.size() - 1;
+    size_t i    = hash_child(parent, offset) & mask;
+    for(; this->child_slots[i]; i = (i + 1) & mask) {
+        const Entry & entry = this->nodes[this->child_slots[i]];
+        if(entry.parent == parent && entry.name == offset)
+            return this->child_slots[i];
+    }
+    Node  node  = this->nodes.size();
+    Entry entry = {parent, offset, NONE, NONE, NONE, nullptr, nullptr};
+    this->nodes.push_back(entry);
+    Entry & up = this->nodes[parent];
+    if(up.last_child == NONE)
+        up.first_child = node;
+    else
+        this->nodes[up.last_child].next = node;
+    up.last_child = node;
+    this->child_slots[i] = node;
+    if(this->nodes.size() * 2 > this->child_slots.size())
+        grow_children();
+    return node;
+}
+
+void VCDPathIndex::add_scope(VCDScope * scope) {
+    Node node = 0;
+    if(scope->parent && scope->type != VCD_SCOPE_ROOT)
+        node = add_child(scope->parent->node, scope->name);
+    scope->node = node;
+    if(!this->nodes[node].scope)
+        this->nodes[node].scope = scope;
+}
+
+void VCDPathIndex::add_signal(VCDSignal * signal) {
+    if(!signal->scope)
+        return;
+    Node node = add_child(signal->scope->node, signal->reference);
+    if(!this->nodes[node].signal)
+        this->nodes[node].signal = signal;
+}
+
+VCDPathIndex::Node VCDPathIndex::find(const std::string & path) const {
+    Node         node = 0;
+    const char * p    = path.c_str();
+    const char * end  = p + path.length();
+    while(p < end) {
+        const char * slash = (const char *)std::memchr(p, '/', end - p);
+        if(!slash)
+            slash = end;
+        if(slash > p) {
+            uint32_t name = find_name(p, slash - p);
+            if(name == NONE)
+                return NONE;
+            size_t mask = this->child_slots.size() - 1;
+            size_t i    = hash_child(node, name) & mask;
+            for(;; i = (i + 1) & mask) {
+                Node child = this->child_slots[i];
+                if(!child)
+                    return NONE;
+                if(this->nodes[child].parent == node &&
+                   this->nodes[child].name == name) {
+                    node = child;
+                    break;
+                }
+            }
+        }
+        p = slash + 1;
+    }
+    return node;
+}
+
+std::string VCDPathIndex::get_path(Node node) const {
+    std::string path;
+    for(; node != 0 && node != NONE; node = this->nodes[node].parent)
+        path = path.empty() ? std::string(get_name(node)) :
+                              get_name(node) + ("/" + path);
+    return path;
+}
+
+void VCDPathIndex::collect(Node node, std::vector<VCDSignal*> & out) const {
+    const Entry & entry = this->nodes[node];
+    if(entry.signal)
+        out.push_back(entry.signal);
+    for(Node child = entry.first_child; child != NONE;
+        child = this->nodes[child].next)
+        collect(child, out);
+}
+
+void VCDPathIndex::find_prefix(const std::string & path,
+                               std::vector<VCDSignal*> & out) const {
+    Node node = find(path);
+    if(node != NONE)
+        collect(node, out);
+}
+
+bool VCDPathIndex::match(const char * pattern, const char * path) {
+    const char * star = nullptr;
+    const char * resume = nullptr;
+    while(*path) {
+        if(*pattern == '*') {
+            star   = ++pattern;
+            resume = path;
+        } else if(*pattern == '?' || *pattern == *path) {
+            pattern++;
+            path++;
+        } else if(star) {
+            pattern = star;
+            path    = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while(*pattern == '*')
+        pattern++;
+    return *pattern == 0;
+}
+
+void VCDPathIndex::find_matching(const std::string & pattern_in,
+                                 std::vector<VCDSignal*> & out) const {
+    // Paths are relative to the root, so a leading '/' is dropped as find
+    // drops it.
+    std::string pattern = pattern_in.substr(std::min(
+        pattern_in.find_first_not_of('/'), pattern_in.length()));
+    size_t wild = pattern.find_first_of("*?");
+    if(wild == std::string::npos) {
+        VCDSignal * signal = get_signal(find(pattern));
+        if(signal)
+            out.push_back(signal);
+        return;
+    }
+    // Only the subtree of the scope named before the first wildcard can
+    // match.
+    size_t slash = pattern.rfind('/', wild);
+    Node   start = 0;
+    if(slash != std::string::npos) {
+        start = find(pattern.substr(0, slash));
+        if(start == NONE)
+            return;
+    }
+    std::string path = get_path(start);
+    std::vector<std::pair<Node, size_t>> stack;
+    stack.push_back(std::make_pair(start, path.length()));
+    // Depth first, in declaration order: children are pushed in reverse.
+    std::vector<Node> children;
+    while(!stack.empty()) {
+        Node   node   = stack.back().first;
+        size_t length = stack.back().second;
+        stack.pop_back();
+        path.resize(length);
+        if(node != start) {
+            if(!path.empty())
+                path += '/';
+            path += get_name(node);
+        }
+        const Entry & entry = this->nodes[node];
+        if(entry.signal && match(pattern.c_str(), path.c_str()))
+            out.push_back(entry.signal);
+        children.clear();
+        for(Node child = entry.first_child; child != NONE;
+            child = this->nodes[child].next)
+            children.push_back(child);
+        for(size_t i = children.size(); i-- > 0;)
+            stack.push_back(std::make_pair(children[i], path.length()));
+    }
+}
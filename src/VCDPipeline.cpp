@@ -0,0 +1,153 @@
+/*!
+@file
+@brief Definition of the VCDPipeline class.
+*/
+
+#include <chrono>
+
+#include "VCDTypes.hpp"
+
+const unsigned VCDPipeline::RING_SIZE;
+
+//! Spinning only helps when the other side runs on another core.
+static const bool SPIN = std::thread::hardware_concurrency() > 1;
+
+/*!
+@brief Wait for the other side of the ring: spin at first, then give up the
+core, then sleep, so that an idle side costs little.
+*/
+static void back_off(unsigned & round) {
+    if(round < 64 && SPIN)
+        ;
+    else if(round < 256)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    round++;
+}
+
+//! Copy from into to, reusing the planes of to when both are vectors.
+static void copy_value(VCDValue & to, const VCDValue & from) {
+    if(to.get_type() == VCD_VECTOR && from.get_type() == VCD_VECTOR)
+        *to.get_value_vector() = *from.get_value_vector();
+    else
+        to = from;
+}
+
+VCDPipeline::VCDPipeline(VCDVisitor & target, size_t size) :
+    target(target), size(size ? size : 1), head(0), tail(0), done(false),
+    filling(false) {
+    for(Batch & batch : this->ring)
+        batch.count = 0;
+    this->consumer = std::thread(&VCDPipeline::run, this);
+}
+
+VCDPipeline::~VCDPipeline() {
+    finish();
+}
+
+VCDPipeline::Batch & VCDPipeline::open_batch() {
+    uint64_t head  = this->head.load(std::memory_order_relaxed);
+    Batch  & batch = this->ring[head % RING_SIZE];
+    if(!this->filling) {
+        unsigned round = 0;
+        while(head - this->tail.load(std::memory_order_acquire) >= RING_SIZE)
+            back_off(round);
+        if(batch.events.size() < this->size) {
+            batch.events.resize(this->size);
+            batch.values.resize(this->size, VCDValue(VCD_X));
+        }
+        batch.count    = 0;
+        this->filling = true;
+    }
+    return batch;
+}
+
+void VCDPipeline::publish() {
+    if(!this->filling)
+        return;
+    this->filling = false;
+    this->head.store(this->head.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_release);
+}
+
+void VCDPipeline::drain() {
+    publish();
+    uint64_t head  = this->head.load(std::memory_order_relaxed);
+    unsigned round = 0;
+    while(this->tail.load(std::memory_order_acquire) != head)
+        back_off(round);
+}
+
+void VCDPipeline::on_timestamp(VCDTime time) {
+    Batch & batch = open_batch();
+    Event & event = batch.events[batch.count++];
+    event.time   = time;
+    event.handle = 0;
+    event.kind   = EVENT_TIMESTAMP;
+    if(batch.count == this->size)
+        publish();
+}
+
+void VCDPipeline::on_value_change(VCDSignalHandle handle, VCDTime time,
+                                  const VCDValue & value) {
+    Batch & batch = open_batch();
+    copy_value(batch.values[batch.count], value);
+    Event & event = batch.events[batch.count++];
+    event.time   = time;
+    event.handle = handle;
+    event.kind   = EVENT_VALUE;
+    if(batch.count == this->size)
+        publish();
+}
+
+void VCDPipeline::on_wait() {
+    Batch & batch = open_batch();
+    Event & event = batch.events[batch.count++];
+    event.time   = 0;
+    event.handle = 0;
+    event.kind   = EVENT_WAIT;
+    // The parser is idle until the file grows, so do not hold anything back.
+    publish();
+}
+
+void VCDPipeline::finish() {
+    if(!this->consumer.joinable())
+        return;
+    publish();
+    this->done.store(true, std::memory_order_release);
+    this->consumer.join();
+}
+
+void VCDPipeline::run() {
+    uint64_t tail  = 0;
+    unsigned round = 0;
+    for(;;) {
+        if(tail == this->head.load(std::memory_order_acquire)) {
+            // done is set after the last publish, so look at head again.
+            if(this->done.load(std::memory_order_acquire) &&
+               tail == this->head.load(std::memory_order_acquire))
+                return;
+            back_off(round);
+            continue;
+        }
+        round = 0;
+        const Batch & batch = this->ring[tail % RING_SIZE];
+        for(size_t i = 0; i < batch.count; i++) {
+            const Event & event = batch.events[i];
+            switch(event.kind) {
+            case EVENT_TIMESTAMP:
+                this->target.on_timestamp(event.time);
+                break;
+            case EVENT_VALUE:
+                this->target.on_value_change(event.handle, event.time,
+                                             batch.values[i]);
+                break;
+            case EVENT_WAIT:
+                this->target.on_wait();
+                break;
+            }
+        }
+        this->tail.store(++tail, std::memory_order_release);
+    }
+}
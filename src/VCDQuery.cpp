@@ -0,0 +1,542 @@
+/*!
+@file
+@brief Definition of the VCDQuery and VCDPattern classes.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "VCDTypes.hpp"
+
+const uint32_t VCDQuery::SKIP;
+
+//! What a signal reads as before its first value.
+static const VCDValue VALUE_X(VCD_X);
+
+//! Number of 64 bit words a scalar or vector value spans.
+static unsigned value_words(const VCDValue & value) {
+    if(value.get_type() != VCD_VECTOR)
+        return 1;
+    return std::max(1u, value.get_value_vector()->words());
+}
+
+/*!
+@brief Word w of the value and X/Z planes of a scalar or vector value, with
+the bits above its width extended as VCD does.
+*/
+static void value_word(const VCDValue & value, unsigned w, uint64_t & val,
+                       uint64_t & xz) {
+    unsigned        width = 1;
+    unsigned        bit   = value.get_value_bit();
+    const VCDBitVector * vec = nullptr;
+    if(value.get_type() == VCD_VECTOR) {
+        vec   = value.get_value_vector();
+        width = vec->size();
+        bit   = width ? vec->get_bit(width - 1) : VCD_0;
+    }
+    // X and Z extend themselves, 0 and 1 extend with 0.
+    uint64_t ext_xz  = (bit & 2) ? ~(uint64_t)0 : 0;
+    uint64_t ext_val = ext_xz & ((bit & 1) ? ~(uint64_t)0 : 0);
+    if(w * 64 >= width) {
+        val = ext_val;
+        xz  = ext_xz;
+        return;
+    }
+    if(vec) {
+        val = vec->value_word(w);
+        xz  = vec->xz_word(w);
+    } else {
+        val = bit & 1;
+        xz  = bit >> 1;
+    }
+    if(width - w * 64 < 64) {
+        uint64_t high = ~(uint64_t)0 << (width - w * 64);
+        val = (val & ~high) | (ext_val & high);
+        xz  = (xz & ~high) | (ext_xz & high);
+    }
+}
+
+//! Least significant bit of a scalar or vector value, as both planes.
+static void value_lsb(const VCDValue & value, uint64_t & val, uint64_t & xz) {
+    if(value.get_type() == VCD_SCALAR) {
+        val = value.get_value_bit() & 1;
+        xz  = value.get_value_bit() >> 1;
+    } else if(value.get_value_vector()->empty()) {
+        val = 0;
+        xz  = 0;
+    } else {
+        val = value.get_value_vector()->value_word(0) & 1;
+        xz  = value.get_value_vector()->xz_word(0) & 1;
+    }
+}
+
+//! True if a and b hold the same value.
+static bool same_value(const VCDValue & a, const VCDValue & b) {
+    if(a.get_type() == VCD_REAL || b.get_type() == VCD_REAL)
+        return a.get_type() == b.get_type() &&
+               a.get_value_real() == b.get_value_real();
+    if(a.get_type() == VCD_VECTOR && b.get_type() == VCD_VECTOR &&
+       a.get_value_vector()->size() == b.get_value_vector()->size()) {
+        // The common case, whole planes compare without extending.
+        const VCDBitVector * av = a.get_value_vector();
+        const VCDBitVector * bv = b.get_value_vector();
+        size_t bytes = av->words() * sizeof(uint64_t);
+        return std::memcmp(av->value_words(), bv->value_words(), bytes) == 0 &&
+               std::memcmp(av->xz_words(), bv->xz_words(), bytes) == 0;
+    }
+    unsigned words = std::max(value_words(a), value_words(b));
+    for(unsigned w = 0; w < words; w++) {
+        uint64_t av, ax, bv, bx;
+        value_word(a, w, av, ax);
+        value_word(b, w, bv, bx);
+        if(av != bv || ax != bx)
+            return false;
+    }
+    return true;
+}
+
+/*!
+@brief Lanes of cv/cx that make an edge coming from the lanes of pv/px.
+@details Each lane is one bit, the value plane holding its low bit and the
+X/Z plane set for X and Z.
+*/
+static uint64_t edge_lanes(VCDEdge edge, uint64_t pv, uint64_t px,
+                           uint64_t cv, uint64_t cx) {
+    uint64_t p0 = ~pv & ~px, p1 = pv & ~px;
+    uint64_t c0 = ~cv & ~cx, c1 = cv & ~cx;
+    switch(edge) {
+    case VCD_EDGE_RISING:
+        return (p0 & ~c0) | (px & c1);
+    case VCD_EDGE_FALLING:
+        return (p1 & ~c1) | (px & c0);
+    default:
+        return (pv ^ cv) | (px ^ cx);
+    }
+}
+
+//! True if going from prev to value is an edge.
+static bool is_edge(VCDEdge edge, const VCDValue & prev,
+                    const VCDValue & value) {
+    if(value.get_type() == VCD_REAL || prev.get_type() == VCD_REAL) {
+        if(edge == VCD_EDGE_ANY)
+            return !same_value(prev, value);
+        if(value.get_type() != prev.get_type())
+            return false;
+        if(edge == VCD_EDGE_RISING)
+            return value.get_value_real() > prev.get_value_real();
+        return value.get_value_real() < prev.get_value_real();
+    }
+    if(edge == VCD_EDGE_ANY)
+        return !same_value(prev, value);
+    uint64_t pv, px, cv, cx;
+    value_lsb(prev, pv, px);
+    value_lsb(value, cv, cx);
+    return edge_lanes(edge, pv, px, cv, cx) & 1;
+}
+
+//! Selects the values that are an edge, see VCDQuery::scan.
+class EdgeSelect {
+    VCDEdge edge;
+public:
+    EdgeSelect(VCDEdge edge) : edge(edge) {}
+    uint64_t operator()(const VCDValue * values, unsigned count,
+                        const VCDValue & prev) const {
+        // Gather the least significant bits into lanes, unless whole values
+        // have to be compared.
+        uint64_t val = 0, xz = 0;
+        bool     lanes = prev.get_type() != VCD_REAL;
+        for(unsigned i = 0; i < count && lanes; i++) {
+            VCDValueType type = values[i].get_type();
+            if(type == VCD_REAL ||
+               (type == VCD_VECTOR && this->edge == VCD_EDGE_ANY)) {
+                lanes = false;
+                break;
+            }
+            uint64_t v, x;
+            value_lsb(values[i], v, x);
+            val |= v << i;
+            xz  |= x << i;
+        }
+        if(!lanes) {
+            uint64_t selected = 0;
+            for(unsigned i = 0; i < count; i++)
+                if(is_edge(this->edge, i ? values[i - 1] : prev, values[i]))
+                    selected |= (uint64_t)1 << i;
+            return selected;
+        }
+        uint64_t pv, px;
+        value_lsb(prev, pv, px);
+        uint64_t used = count < 64 ? ((uint64_t)1 << count) - 1 : ~(uint64_t)0;
+        return edge_lanes(this->edge, val << 1 | pv, xz << 1 | px, val, xz) &
+               used;
+    }
+};
+
+//! Selects the values that match a pattern, see VCDQuery::scan.
+class MatchSelect {
+    const VCDPattern & pattern;
+public:
+    MatchSelect(const VCDPattern & pattern) : pattern(pattern) {}
+    uint64_t operator()(const VCDValue * values, unsigned count,
+                        const VCDValue &) const {
+        uint64_t selected = 0;
+        for(unsigned i = 0; i < count; i++)
+            if(this->pattern.matches(values[i]))
+                selected |= (uint64_t)1 << i;
+        return selected;
+    }
+};
+
+VCDPattern::VCDPattern(const std::string & text) : width(0) {
+    std::string bits;
+    for(char c : text)
+        if(c != '_')
+            bits += c;
+    this->width = bits.size();
+    unsigned words = (this->width + 63) / 64;
+    this->planes.assign(3 * (words + 1), 0);
+    // Value, xz and care bit of each character.
+    auto decode = [](char c, uint64_t & v, uint64_t & x, uint64_t & care) {
+        v = x = 0;
+        care  = 1;
+        switch(c) {
+        case '0':
+            break;
+        case '1':
+            v = 1;
+            break;
+        case 'z':
+        case 'Z':
+            v = x = 1;
+            break;
+        case '?':
+            care = 0;
+            break;
+        default:
+            x = 1;
+            break;
+        }
+    };
+    for(unsigned i = 0; i < this->width; i++) {
+        uint64_t v, x, care;
+        decode(bits[this->width - 1 - i], v, x, care);
+        this->planes[3 * (i / 64)]     |= v << (i % 64);
+        this->planes[3 * (i / 64) + 1] |= x << (i % 64);
+        this->planes[3 * (i / 64) + 2] |= care << (i % 64);
+    }
+    // X, Z and ? extend themselves, 0 and 1 extend with 0.
+    uint64_t v = 0, x = 0, care = 1;
+    if(this->width)
+        decode(bits[0], v, x, care);
+    if(!x && care)
+        v = 0;
+    uint64_t * ext = &this->planes[3 * words];
+    ext[0] = v ? ~(uint64_t)0 : 0;
+    ext[1] = x ? ~(uint64_t)0 : 0;
+    ext[2] = care ? ~(uint64_t)0 : 0;
+    if(this->width % 64) {
+        uint64_t   high = ~(uint64_t)0 << (this->width % 64);
+        uint64_t * last = &this->planes[3 * (words - 1)];
+        for(int p = 0; p < 3; p++)
+            last[p] |= ext[p] & high;
+    }
+}
+
+bool VCDPattern::matches(const VCDValue & value) const {
+    if(value.get_type() == VCD_REAL)
+        return false;
+    unsigned own   = this->planes.size() / 3 - 1;
+    unsigned words = std::max(own, value_words(value));
+    for(unsigned w = 0; w < words; w++) {
+        const uint64_t * pattern = &this->planes[3 * std::min(w, own)];
+        uint64_t val, xz;
+        value_word(value, w, val, xz);
+        if(((val ^ pattern[0]) | (xz ^ pattern[1])) & pattern[2])
+            return false;
+    }
+    return true;
+}
+
+VCDQuery::VCDQuery(VCDFile * file, unsigned threads) :
+    file(file), threads(threads) {
+    // Each block gets an entry at its start and every SKIP values after.
+    size_t handles = file->get_handle_count();
+    if(file->is_compressed()) {
+        this->mark_begin.assign(handles + 1, 0);
+        return;
+    }
+    this->mark_begin.resize(handles + 1);
+    size_t total = 0;
+    for(size_t h = 0; h < handles; h++) {
+        this->mark_begin[h] = total;
+        const VCDSignalValues * values = file->get_signal_values(h);
+        for(const VCDValueBlock * block = values->first_block(); block;
+            block = block->next)
+            total += (block->count + SKIP - 1) / SKIP;
+    }
+    this->mark_begin[handles] = total;
+    this->marks.resize(total);
+    run(handles, [this](size_t h) { build(h); });
+}
+
+void VCDQuery::build(VCDSignalHandle handle) {
+    const VCDSignalValues * values = this->file->get_signal_values(handle);
+    if(values->empty())
+        return;
+    Mark   * mark     = &this->marks[this->mark_begin[handle]];
+    uint64_t position = 0;
+    for(const VCDValueBlock * block = values->first_block(); block;
+        block = block->next) {
+        const uint8_t * p    = block->deltas;
+        VCDTime         time = block->first;
+        for(uint32_t i = 0; i < block->count; i++) {
+            if(i)
+                time = VCDTimeList::decode(p, time);
+            if(i % SKIP == 0) {
+                mark->time     = time;
+                mark->block    = block;
+                mark->index    = i;
+                mark->offset   = p - block->deltas;
+                mark->position = position + i;
+                mark++;
+            }
+        }
+        position += block->count;
+    }
+}
+
+void VCDQuery::advance(Cursor & cursor, uint64_t count) {
+    while(count && cursor.block) {
+        uint32_t left = cursor.block->count - cursor.index;
+        if(count >= left) {
+            // Skip the rest of the block without decoding it.
+            count           -= left;
+            cursor.position += left;
+            cursor.block     = cursor.block->next;
+            cursor.index     = 0;
+            if(cursor.block) {
+                cursor.time = cursor.block->first;
+                cursor.next = cursor.block->deltas;
+            }
+            continue;
+        }
+        cursor.position += count;
+        cursor.index    += count;
+        for(; count; count--)
+            cursor.time = VCDTimeList::decode(cursor.next, cursor.time);
+    }
+}
+
+VCDQuery::Cursor VCDQuery::seek(VCDSignalHandle handle, VCDTime time) const {
+    Cursor cursor = {nullptr, 0, nullptr, 0, 0, nullptr, 0};
+    const Mark * first = this->marks.data() + this->mark_begin[handle];
+    const Mark * last  = this->marks.data() + this->mark_begin[handle + 1];
+    const Mark * mark  = std::lower_bound(first, last, time,
+                                          [](const Mark & m, VCDTime t) {
+                                              return m.time < t;
+                                          });
+    if(mark == first) {
+        // No value before time.
+        if(first != last) {
+            cursor.block = first->block;
+            cursor.time  = first->time;
+            cursor.next  = first->block->deltas;
+        }
+        return cursor;
+    }
+    // Start from the last entry before time and step past the values
+    // before it, remembering the last of them.
+    mark--;
+    cursor.block    = mark->block;
+    cursor.index    = mark->index;
+    cursor.next     = mark->block->deltas + mark->offset;
+    cursor.time     = mark->time;
+    cursor.position = mark->position;
+    while(cursor.block && cursor.time < time) {
+        cursor.prev      = &cursor.block->values[cursor.index];
+        cursor.prev_time = cursor.time;
+        advance(cursor, 1);
+    }
+    return cursor;
+}
+
+template<class Select>
+size_t VCDQuery::scan(VCDSignalHandle handle, VCDTime t0, VCDTime t1,
+                      Select select, std::vector<VCDTime> * out) const {
+    if(t1 < t0)
+        return 0;
+    if(const VCDHistory * history = this->file->get_history(handle))
+        return scan_history(history, t0, t1, select, out);
+    const VCDSignalValues * values = this->file->get_signal_values(handle);
+    Cursor   cursor = seek(handle, t0);
+    uint64_t end    = t1 == std::numeric_limits<VCDTime>::max() ?
+                      values->size() : seek(handle, t1 + 1).position;
+    // Times are only decoded for reported values, by a second cursor.
+    Cursor           times  = cursor;
+    const VCDValue * prev   = cursor.prev ? cursor.prev : &VALUE_X;
+    size_t           count  = 0;
+    while(cursor.position < end) {
+        const VCDValue * chunk = &cursor.block->values[cursor.index];
+        unsigned n = std::min<uint64_t>(std::min<uint64_t>(64,
+                         cursor.block->count - cursor.index),
+                         end - cursor.position);
+        uint64_t selected = select(chunk, n, *prev);
+        count += __builtin_popcountll(selected);
+        for(; out && selected; selected &= selected - 1) {
+            uint64_t position = cursor.position + __builtin_ctzll(selected);
+            advance(times, position - times.position);
+            out->push_back(times.time);
+        }
+        prev             = &chunk[n - 1];
+        cursor.position += n;
+        if((cursor.index += n) == cursor.block->count) {
+            cursor.block = cursor.block->next;
+            cursor.index = 0;
+        }
+    }
+    return count;
+}
+
+template<class Select>
+size_t VCDQuery::scan_history(const VCDHistory * history, VCDTime t0,
+                              VCDTime t1, Select select,
+                              std::vector<VCDTime> * out) const {
+    VCDValue prev(VCD_X);
+    if(t0)
+        history->value_at(t0 - 1, prev);
+    // Values are copied out 64 at a time, with their times.
+    std::vector<VCDValue> chunk(64, VALUE_X);
+    VCDTime               times[64];
+    size_t                count = 0;
+    VCDHistory::const_iterator it = history->lower_bound(t0);
+    VCDHistory::const_iterator end = history->end();
+    for(bool done = false; !done;) {
+        unsigned n = 0;
+        for(; n < 64 && it != end; ++it, n++) {
+            VCDTimedValue tv = *it;
+            if(tv.time > t1)
+                break;
+            times[n] = tv.time;
+            chunk[n] = *tv.value;
+        }
+        done = n < 64;
+        if(n == 0)
+            break;
+        uint64_t selected = select(chunk.data(), n, prev);
+        count += __builtin_popcountll(selected);
+        for(; out && selected; selected &= selected - 1)
+            out->push_back(times[__builtin_ctzll(selected)]);
+        prev = chunk[n - 1];
+    }
+    return count;
+}
+
+void VCDQuery::run(size_t count, const std::function<void(size_t)> & fn) const {
+    size_t workers = this->threads;
+    if(workers == 0)
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    workers = std::min(workers, count);
+    if(workers <= 1) {
+        for(size_t i = 0; i < count; i++)
+            fn(i);
+        return;
+    }
+    // Hand out items in small batches, histories differ a lot in length.
+    const size_t        batch = 16;
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        for(size_t i; (i = next.fetch_add(batch)) < count;)
+            for(size_t end = std::min(i + batch, count); i < end; i++)
+                fn(i);
+    };
+    std::vector<std::thread> pool;
+    for(size_t i = 1; i < workers; i++)
+        pool.push_back(std::thread(work));
+    work();
+    for(std::thread & thread : pool)
+        thread.join();
+}
+
+VCDTimedValue VCDQuery::value_at(VCDSignalHandle handle, VCDTime time,
+                                  VCDValue & storage) const {
+    VCDTimedValue tv = {0, nullptr};
+    if(const VCDHistory * history = this->file->get_history(handle)) {
+        if(history->value_at(time, storage, &tv.time))
+            tv.value = &storage;
+        return tv;
+    }
+    const VCDSignalValues * values = this->file->get_signal_values(handle);
+    if(values->empty())
+        return tv;
+    if(time == std::numeric_limits<VCDTime>::max())
+        return values->back();
+    Cursor cursor = seek(handle, time + 1);
+    tv.time  = cursor.prev_time;
+    tv.value = const_cast<VCDValue *>(cursor.prev);
+    return tv;
+}
+
+size_t VCDQuery::count_values(VCDSignalHandle handle, VCDTime t0,
+                              VCDTime t1) const {
+    if(t1 < t0)
+        return 0;
+    if(const VCDHistory * history = this->file->get_history(handle)) {
+        size_t end = t1 == std::numeric_limits<VCDTime>::max() ?
+                     history->size() :
+                     history->lower_bound(t1 + 1).position();
+        return end - history->lower_bound(t0).position();
+    }
+    uint64_t end = t1 == std::numeric_limits<VCDTime>::max() ?
+                   this->file->get_signal_values(handle)->size() :
+                   seek(handle, t1 + 1).position;
+    return end - seek(handle, t0).position;
+}
+
+size_t VCDQuery::find_edges(VCDSignalHandle handle, VCDEdge edge, VCDTime t0,
+                            VCDTime t1, std::vector<VCDTime> * out) const {
+    return scan(handle, t0, t1, EdgeSelect(edge), out);
+}
+
+size_t VCDQuery::find_matches(VCDSignalHandle handle,
+                              const VCDPattern & pattern, VCDTime t0,
+                              VCDTime t1, std::vector<VCDTime> * out) const {
+    return scan(handle, t0, t1, MatchSelect(pattern), out);
+}
+
+void VCDQuery::values_at(const std::vector<VCDSignalHandle> & handles,
+                         VCDTime time,
+                         std::vector<VCDTimedValue> & values,
+                         std::vector<VCDValue> & storage) const {
+    values.resize(handles.size());
+    storage.resize(handles.size(), VALUE_X);
+    run(handles.size(), [&](size_t i) {
+        values[i] = value_at(handles[i], time, storage[i]);
+    });
+}
+
+void VCDQuery::count_edges(const std::vector<VCDSignalHandle> & handles,
+                           VCDEdge edge, VCDTime t0, VCDTime t1,
+                           std::vector<size_t> & counts) const {
+    counts.resize(handles.size());
+    run(handles.size(), [&](size_t i) {
+        counts[i] = find_edges(handles[i], edge, t0, t1);
+    });
+}
+
+void VCDQuery::count_matches(const std::vector<VCDSignalHandle> & handles,
+                             const VCDPattern & pattern, VCDTime t0,
+                             VCDTime t1, std::vector<size_t> & counts) const {
+    counts.resize(handles.size());
+    run(handles.size(), [&](size_t i) {
+        counts[i] = find_matches(handles[i], pattern, t0, t1);
+    });
+}
+
+void VCDQuery::for_each(const std::vector<VCDSignalHandle> & handles,
+                        const std::function<void(VCDSignalHandle)> & fn)
+                        const {
+    run(handles.size(), [&](size_t i) {
+        fn(handles[i]);
+    });
+}
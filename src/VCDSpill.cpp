@@ -0,0 +1,108 @@
+/*!
+@file
+@brief Definition of the VCDSpill class.
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "VCDTypes.hpp"
+
+const size_t VCDSpill::REGION_SIZE;
+
+//! Chunks are released a page at a time, so they are whole pages.
+static const size_t PAGE_SIZE = 4096;
+
+VCDSpill * VCDSpill::create(size_t budget, const std::string & directory) {
+    std::string dir = directory;
+    if(dir.empty()) {
+        const char * tmp = std::getenv("TMPDIR");
+        dir = tmp && *tmp ? tmp : "/tmp";
+    }
+    std::string name = dir + "/vcd-spill-XXXXXX";
+    std::vector<char> path(name.begin(), name.end());
+    path.push_back(0);
+    int fd = mkstemp(path.data());
+    if(fd < 0)
+        return nullptr;
+    unlink(path.data());
+    return new VCDSpill(fd, budget);
+}
+
+VCDSpill::~VCDSpill() {
+    for(const Chunk & region : this->regions)
+        munmap(region.base, region.size);
+    close(this->fd);
+}
+
+char * VCDSpill::map(size_t bytes) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    bytes = (bytes + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    // Large requests get a region of their own, the current one carries on.
+    bool own = bytes > REGION_SIZE / 4;
+    if(own || bytes > this->left) {
+        size_t size = own ? bytes : REGION_SIZE;
+        // Reserve the disk space now, rather than fault on a full disk later.
+        if(posix_fallocate(this->fd, this->file_size, size) != 0)
+            return nullptr;
+        void * base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                           this->fd, this->file_size);
+        if(base == MAP_FAILED)
+            return nullptr;
+        Chunk region = {(char *)base, this->file_size, size, false};
+        this->regions.push_back(region);
+        this->file_size += size;
+        if(!own) {
+            this->next = (char *)base;
+            this->left = size;
+        }
+    }
+    Chunk chunk;
+    if(own) {
+        chunk = this->regions.back();
+    } else {
+        const Chunk & region = this->regions.back();
+        chunk.base   = this->next;
+        chunk.offset = region.offset + (this->next - region.base);
+        chunk.size   = bytes;
+        this->next  += bytes;
+        this->left  -= bytes;
+    }
+    chunk.released = false;
+    this->chunks.push_back(chunk);
+    this->handed   += bytes;
+    this->resident += bytes;
+    if(this->handed > this->budget)
+        release();
+    return chunk.base;
+}
+
+void VCDSpill::release() {
+    // The newest chunk is about to be filled, so it stays.
+    size_t older = this->chunks.size() - 1;
+    // At least one chunk goes each time, even when under budget, so pages
+    // that were touched again after their release are found in turn.
+    for(size_t steps = 0; steps < older; steps++) {
+        if(this->hand >= older)
+            this->hand = 0;
+        Chunk & chunk = this->chunks[this->hand++];
+        sync_file_range(this->fd, chunk.offset, chunk.size,
+                        SYNC_FILE_RANGE_WRITE);
+        madvise(chunk.base, chunk.size, MADV_DONTNEED);
+        if(!chunk.released) {
+            chunk.released  = true;
+            this->resident -= chunk.size;
+            this->spilled  += chunk.size;
+        }
+        if(this->resident <= this->budget)
+            break;
+    }
+}
+
+size_t VCDSpill::get_spilled() {
+    std::lock_guard<std::mutex> guard(this->lock);
+    return this->spilled;
+}
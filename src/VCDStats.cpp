@@ -0,0 +1,109 @@
+/*!
+@file
+@brief Definition of the VCDStats class.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "VCDTypes.hpp"
+
+VCDStats::VCDStats() :
+    bytes(0), tokens(0), timestamps(0), changes(0) {
+    for(int i = 0; i < STATS_PHASES; i++)
+        this->seconds[i] = 0;
+}
+
+void VCDStats::add_input(const std::string & filepath) {
+    struct stat st;
+    if(stat(filepath.c_str(), &st) == 0)
+        this->bytes += st.st_size;
+}
+
+void VCDStats::add_file(VCDFile * file, bool stored) {
+    size_t count = file->get_handle_count();
+    this->add_handles(count);
+    if(this->signal_names.size() < count)
+        this->signal_names.resize(count);
+    for(VCDSignal * signal : *file->get_signals()) {
+        std::string & name = this->signal_names[signal->handle];
+        if(name.empty())
+            name = VCDFile::signal_path(signal);
+    }
+    if(!stored)
+        return;
+    for(size_t h = 0; h < count; h++) {
+        size_t values = file->get_value_count(h);
+        this->signal_changes[h] += values;
+        this->changes           += values;
+    }
+    this->timestamps += file->get_timestamps()->size();
+}
+
+#ifndef VCD_NO_STATS
+//! Guards rates against phases too short to measure.
+static double per_second(double amount, double seconds) {
+    return seconds > 0 ? amount / seconds : 0;
+}
+#endif
+
+void VCDStats::print(FILE * out, unsigned top) const {
+#ifdef VCD_NO_STATS
+    std::fprintf(out, "statistics are compiled out (VCD_NO_STATS)\n");
+#else
+    static const char * NAMES[STATS_PHASES] = {
+        "input", "declarations", "values", "  merge", "  output", "cache"
+    };
+    double total = this->seconds[STATS_INPUT] +
+                   this->seconds[STATS_DECLARATIONS] +
+                   this->seconds[STATS_VALUES] + this->seconds[STATS_CACHE];
+    std::fprintf(out, "%-14s %10s %6s\n", "phase", "seconds", "%");
+    for(int i = 0; i < STATS_PHASES; i++)
+        std::fprintf(out, "%-14s %10.3f %6.1f\n", NAMES[i], this->seconds[i],
+                     per_second(100 * this->seconds[i], total));
+    std::fprintf(out, "%-14s %10.3f\n\n", "total", total);
+
+    double values = this->seconds[STATS_VALUES];
+    struct rusage usage;
+    long peak_rss = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+    std::fprintf(out, "bytes          %llu (%.1f MB/s)\n",
+                 (unsigned long long)this->bytes,
+                 per_second(this->bytes / 1e6, total));
+    std::fprintf(out, "tokens         %llu (%.0f/s)\n",
+                 (unsigned long long)this->tokens,
+                 per_second(this->tokens, this->seconds[STATS_DECLARATIONS]));
+    std::fprintf(out, "timestamps     %llu\n",
+                 (unsigned long long)this->timestamps);
+    std::fprintf(out, "changes        %llu (%.0f/s)\n",
+                 (unsigned long long)this->changes,
+                 per_second(this->changes, values));
+    std::fprintf(out, "peak rss       %ld KB\n", peak_rss);
+
+    std::vector<size_t> order;
+    for(size_t h = 0; h < this->signal_changes.size(); h++)
+        if(this->signal_changes[h])
+            order.push_back(h);
+    size_t shown = std::min<size_t>(top, order.size());
+    std::partial_sort(order.begin(), order.begin() + shown, order.end(),
+        [this](size_t a, size_t b) {
+            if(this->signal_changes[a] != this->signal_changes[b])
+                return this->signal_changes[a] > this->signal_changes[b];
+            return a < b;
+        });
+    if(shown == 0)
+        return;
+    std::fprintf(out, "\n%12s %6s  %s\n", "changes", "%", "signal");
+    for(size_t i = 0; i < shown; i++) {
+        size_t h = order[i];
+        const char * name = h < this->signal_names.size() &&
+            !this->signal_names[h].empty() ?
+            this->signal_names[h].c_str() : "?";
+        std::fprintf(out, "%12llu %6.2f  %s\n",
+                     (unsigned long long)this->signal_changes[h],
+                     per_second(100.0 * this->signal_changes[h],
+                                this->changes), name);
+    }
+#endif
+}
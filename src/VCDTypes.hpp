@@ -1,5 +1,17 @@
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
 #include <map>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
 #include <utility>
 #include <string>
 #include <vector>
@@ -12,8 +24,49 @@
 //! Compressed hash representation of a signal.
 typedef std::string VCDSignalHash;
 
-//! Represents a single instant in time in a trace
-typedef double VCDTime;
+/*!
+@brief Dense index of a signal, assigned when its $var is declared.
+@details Signals sharing an identifier code share a handle.
+*/
+typedef uint32_t VCDSignalHandle;
+
+//! Returned by handle lookups for identifier codes that were not declared.
+const VCDSignalHandle VCD_HANDLE_NONE = (VCDSignalHandle)-1;
+
+//! Represents a single instant in time in a trace, in timescale units.
+typedef uint64_t VCDTime;
+
+/*!
+@brief Parse the decimal number at p, leaving p at the first character that
+is not a digit.
+@details Eight digits are converted at a time while they are available.
+Numbers beyond 64 bits wrap around.
+*/
+inline VCDTime vcd_parse_time(const char *& p, const char * end) {
+    VCDTime time = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while(end - p >= 8) {
+        uint64_t chunk;
+        std::memcpy(&chunk, p, sizeof(chunk));
+        // All eight are digits when every byte is 0x3n with n below 10.
+        if((chunk & 0xf0f0f0f0f0f0f0f0ULL) != 0x3030303030303030ULL ||
+           ((chunk + 0x0606060606060606ULL) & 0xf0f0f0f0f0f0f0f0ULL) !=
+           0x3030303030303030ULL)
+            break;
+        // The first digit is in the lowest byte, combine pairs, then
+        // quads, then the two halves.
+        chunk -= 0x3030303030303030ULL;
+        chunk = (chunk * 10 + (chunk >> 8)) & 0x00ff00ff00ff00ffULL;
+        chunk = (chunk * 100 + (chunk >> 16)) & 0x0000ffff0000ffffULL;
+        chunk = (chunk * 10000 + (chunk >> 32)) & 0xffffffffULL;
+        time = time * 100000000 + chunk;
+        p += 8;
+    }
+#endif
+    for(; p < end && *p >= '0' && *p <= '9'; p++)
+        time = time * 10 + (*p - '0');
+    return time;
+}
 
 //! Specifies the timing resoloution along with VCDTimeUnit
 typedef unsigned VCDTimeRes;
@@ -29,8 +82,360 @@ typedef enum {
     VCD_Z = 3   //!< High Impedence.
 } VCDBit;
 
-//! A vector of VCDBit values.
-typedef std::vector<VCDBit> VCDBitVector;
+/*!
+@brief Temporary file that VCDArena chunks are mapped from, so that stored
+values can leave memory and come back when they are used.
+@details The file is unlinked as soon as it is created. Once more than the
+budget of chunk bytes has been handed out, each new chunk releases an older
+one, oldest first and then round robin: its pages are queued for writing to
+the file and dropped from the process. A released page is faulted back in
+from the page cache or the file when it is touched, and released again when
+its turn comes round. Pages read back once the arena stops growing stay
+mapped, but they are clean then, so the kernel can reclaim them under memory
+pressure. Safe to share between arenas on different threads.
+*/
+class VCDSpill {
+    //! A piece of a mapping handed out as one chunk.
+    typedef struct {
+        char   * base;     //!< Start of the chunk.
+        uint64_t offset;   //!< Position of the chunk in the file.
+        size_t   size;     //!< Bytes in the chunk.
+        bool     released; //!< Released at least once.
+    } Chunk;
+
+    //! The open, unlinked file.
+    int                 fd;
+    //! Resident chunk bytes allowed.
+    size_t              budget;
+    //! Bytes of the file mapped so far.
+    uint64_t            file_size;
+    //! Whole mappings, released by the destructor.
+    std::vector<Chunk>  regions;
+    //! Chunks in the order they were handed out.
+    std::vector<Chunk>  chunks;
+    //! Chunk bytes handed out.
+    size_t              handed;
+    //! Chunk bytes handed out and not released since.
+    size_t              resident;
+    //! Chunk bytes released at least once.
+    size_t              spilled;
+    //! Next chunk to release.
+    size_t              hand;
+    //! Rest of the newest region, not handed out yet.
+    char              * next;
+    size_t              left;
+    std::mutex          lock;
+
+    VCDSpill(int fd, size_t budget) : fd(fd), budget(budget), file_size(0),
+        handed(0), resident(0), spilled(0), hand(0), next(nullptr),
+        left(0) {}
+    //! Release chunks until the budget is kept, must hold lock.
+    void release();
+public:
+    //! Bytes of file mapped at a time, chunks are carved out of it.
+    static const size_t REGION_SIZE = 64 << 20;
+
+    /*!
+    @brief Create the file in directory, or in $TMPDIR or /tmp if it is
+    empty.
+    @param budget Chunk bytes kept in memory.
+    @returns nullptr if the file cannot be created.
+    */
+    static VCDSpill * create(size_t budget, const std::string & directory);
+    ~VCDSpill();
+
+    /*!
+    @brief Map bytes of the file as a chunk.
+    @returns nullptr if the file cannot grow, for example when the disk is
+    full.
+    */
+    char * map(size_t bytes);
+    //! Chunk bytes released to the file at least once.
+    size_t get_spilled();
+};
+
+/*!
+@brief Bump allocator that hands out memory from large chunks.
+@details Nothing is freed individually, all chunks are released together
+when the arena is destroyed. Objects placed in an arena must therefore not
+own other memory.
+*/
+class VCDArena {
+    //! All chunks allocated so far.
+    std::vector<char*> chunks;
+    //! Next free byte in the current chunk.
+    char  * next;
+    //! Bytes left in the current chunk.
+    size_t  left;
+    //! File new chunks are mapped from, nullptr to take them from the heap.
+    VCDSpill * spill;
+    //! A new chunk of bytes, from spill if possible.
+    char * take_chunk(size_t bytes);
+public:
+    //! Size of a regular chunk. Larger requests get a chunk of their own.
+    static const size_t CHUNK_SIZE = 1 << 20;
+
+    VCDArena() : next(nullptr), left(0), spill(nullptr) {}
+    ~VCDArena() {
+        for(char * chunk : this->chunks)
+            delete [] chunk;
+    }
+    //! Allocate bytes of memory aligned to 8 bytes.
+    void * allocate(size_t bytes);
+    //! Take over the chunks of other, which is left empty.
+    void adopt(VCDArena & other) {
+        this->chunks.insert(this->chunks.end(), other.chunks.begin(),
+                            other.chunks.end());
+        other.chunks.clear();
+        other.next = nullptr;
+        other.left = 0;
+    }
+    //! Number of chunks allocated by this arena from the heap.
+    size_t get_chunk_count() const {
+        return this->chunks.size();
+    }
+    /*!
+    @brief Map later chunks from spill, which owns them and must outlive
+    the arena.
+    */
+    void set_spill(VCDSpill * spill) {
+        this->spill = spill;
+    }
+};
+
+/*!
+@brief A vector of VCDBit values, packed two bits per VCDBit.
+@details Bits are held in two planes of 64 bit words. The value plane holds
+the low bit of each VCDBit and the xz plane is set for X and Z, so a bit
+reads back as value | xz << 1. Vectors of up to 64 bits are stored inline,
+wider ones in a single block holding the value plane followed by the xz
+plane.
+
+Whether any bit is X or Z is remembered when the vector is assigned or
+copied, so is_known does not have to look at the planes then.
+
+Blocks are normally owned heap memory. A vector placed into a VCDArena
+refers to its block by an offset from its own address instead, and owns
+nothing.
+
+Indexing with [] and iteration run from the leftmost (most significant)
+bit, in the order the bits are written in the VCD file. Words and
+get_bit/set_bit are numbered from the least significant end.
+*/
+class VCDBitVector {
+    //! Number of bits in the vector.
+    VCDSignalSize width;
+    //! True if the block is not owned, see store.offset.
+    bool          external;
+    //! True if no bit is X or Z, false if they have to be checked.
+    bool          known;
+    //! Plane storage, inline for narrow vectors.
+    union {
+        uint64_t   local[2]; //!< Value and xz plane of up to 64 bits.
+        uint64_t * heap;     //!< Owned block, value plane then xz plane.
+        int64_t    offset;   //!< Distance from this object to its block.
+    } store;
+
+    //! True if the planes are kept in a separate block.
+    bool is_heap() const {
+        return this->width > 64;
+    }
+    //! Start of the value plane, the xz plane follows after words().
+    uint64_t * planes() {
+        if(!is_heap())
+            return this->store.local;
+        if(this->external)
+            return (uint64_t *)((char *)this + this->store.offset);
+        return this->store.heap;
+    }
+    const uint64_t * planes() const {
+        return const_cast<VCDBitVector *>(this)->planes();
+    }
+    //! Set the width and allocate cleared planes for it.
+    void allocate(VCDSignalSize width);
+    //! Release the planes.
+    void release() {
+        if(is_heap() && !this->external)
+            delete [] this->store.heap;
+        this->width    = 0;
+        this->external = false;
+    }
+
+public:
+    //! Iterates over the bits starting from the leftmost one.
+    class const_iterator {
+        const VCDBitVector * vec;
+        VCDSignalSize        index;
+    public:
+        const_iterator(const VCDBitVector * vec, VCDSignalSize index) :
+            vec(vec), index(index) {}
+        VCDBit operator*() const {
+            return (*vec)[index];
+        }
+        const_iterator & operator++() {
+            index++;
+            return *this;
+        }
+        bool operator!=(const const_iterator & other) const {
+            return index != other.index;
+        }
+        bool operator==(const const_iterator & other) const {
+            return index == other.index;
+        }
+    };
+
+    //! Create an empty vector.
+    VCDBitVector() : width(0), external(false), known(true) {}
+    //! Create a vector of width bits, all VCD_0.
+    explicit VCDBitVector(VCDSignalSize width) :
+        width(0), external(false), known(true) {
+        allocate(width);
+    }
+    //! Create a vector from the 0/1/x/z characters of a VCD binary value.
+    VCDBitVector(const char * text, size_t length) :
+        width(0), external(false), known(true) {
+        assign(text, length);
+    }
+    VCDBitVector(const VCDBitVector & other);
+    VCDBitVector(VCDBitVector && other) :
+        width(0), external(false), known(true) {
+        *this = std::move(other);
+    }
+    VCDBitVector & operator=(const VCDBitVector & other);
+    VCDBitVector & operator=(VCDBitVector && other);
+    ~VCDBitVector() {
+        release();
+    }
+
+    /*!
+    @brief Replace the contents with a copy of other whose planes are
+    allocated from arena.
+    @details The vector must not move afterwards, which holds for objects
+    that live in the arena themselves.
+    */
+    void place(const VCDBitVector & other, VCDArena & arena);
+    /*!
+    @brief Refer to planes offset bytes from this object, without owning
+    them.
+    @details Nothing is released, this is meant for byte copies of vectors
+    that are being laid out in a cache file.
+    */
+    void set_block_offset(int64_t offset) {
+        this->external     = true;
+        this->store.offset = offset;
+    }
+    /*!
+    @brief True if the planes lie within the size bytes at base.
+    @details For checking byte copies read back from a cache file, where
+    wide vectors must refer to their planes by offset.
+    */
+    bool planes_within(const char * base, uint64_t size) const {
+        if(!is_heap())
+            return true;
+        if(!this->external)
+            return false;
+        // Unsigned, so that a wild offset wraps to a large position.
+        uint64_t at = (uint64_t)((const char *)this - base) +
+                      (uint64_t)this->store.offset;
+        return at <= size &&
+               size - at >= 2 * (uint64_t)words() * sizeof(uint64_t);
+    }
+
+    /*!
+    @brief Replace the contents with the bits of a VCD binary value.
+    @details Whole words of 64 characters are classified with SSE2 or AVX2
+    where the compiler targets them, and eight at a time otherwise.
+    @param text in - Characters 0, 1, x/X or z/Z, leftmost bit first. Any
+    other character reads as X.
+    @param length in - Number of characters in text.
+    @param width in - Width to extend a shorter value to, as VCD does: with
+    the leftmost bit if it is X or Z and with 0 otherwise.
+    */
+    void assign(const char * text, size_t length, VCDSignalSize width = 0);
+    //! Set every bit of a vector of width bits to VCD_0, reusing the planes.
+    void clear(VCDSignalSize width) {
+        allocate(width);
+    }
+
+    //! Number of bits in the vector.
+    VCDSignalSize size() const {
+        return this->width;
+    }
+    bool empty() const {
+        return this->width == 0;
+    }
+    //! Number of 64 bit words in each plane.
+    unsigned words() const {
+        return (this->width + 63) / 64;
+    }
+    //! Value plane, words() words long, least significant word first.
+    uint64_t * value_words() {
+        return planes();
+    }
+    const uint64_t * value_words() const {
+        return planes();
+    }
+    //! X/Z plane, words() words long, least significant word first.
+    uint64_t * xz_words() {
+        // The caller may set X or Z bits.
+        this->known = false;
+        return planes() + words();
+    }
+    const uint64_t * xz_words() const {
+        return planes() + words();
+    }
+    //! Word i of the value plane.
+    uint64_t value_word(unsigned i) const {
+        return value_words()[i];
+    }
+    //! Word i of the X/Z plane.
+    uint64_t xz_word(unsigned i) const {
+        return xz_words()[i];
+    }
+
+    //! Bit i, counting from the least significant bit.
+    VCDBit get_bit(VCDSignalSize i) const {
+        unsigned v = (value_words()[i / 64] >> (i % 64)) & 1;
+        unsigned x = (xz_words()[i / 64] >> (i % 64)) & 1;
+        return (VCDBit)(v | x << 1);
+    }
+    //! Set bit i, counting from the least significant bit.
+    void set_bit(VCDSignalSize i, VCDBit b) {
+        uint64_t mask = (uint64_t)1 << (i % 64);
+        uint64_t & v = value_words()[i / 64];
+        uint64_t & x = xz_words()[i / 64];
+        v = (b & 1) ? (v | mask) : (v & ~mask);
+        x = (b & 2) ? (x | mask) : (x & ~mask);
+    }
+    //! Bit i, counting from the leftmost bit.
+    VCDBit operator[](VCDSignalSize i) const {
+        return get_bit(this->width - 1 - i);
+    }
+
+    const_iterator begin() const {
+        return const_iterator(this, 0);
+    }
+    const_iterator end() const {
+        return const_iterator(this, this->width);
+    }
+
+    //! True if no bit is X or Z.
+    bool is_known() const;
+    //! True if other has the same width and bits.
+    bool operator==(const VCDBitVector & other) const;
+    bool operator!=(const VCDBitVector & other) const {
+        return !(*this == other);
+    }
+
+    //! Bits as 0/1/X/Z characters, leftmost first.
+    std::string to_string() const;
+    /*!
+    @brief Value as lower case hex digits, most significant first.
+    @details A digit covering any X or Z bit is printed as 'z' if all of
+    its bits are Z and 'x' otherwise.
+    */
+    std::string to_hex() const;
+};
 
 //! Typedef to identify a real number as stored in a VCD.
 typedef double VCDReal;
@@ -51,8 +456,8 @@ typedef struct {
     VCDValue  * value;
 } VCDTimedValue;
 
-//! A vector of tagged time/value pairs, sorted by time values.
-typedef std::vector<VCDTimedValue*> VCDSignalValues;
+// Forward declaration of class.
+class VCDSignalValues;
 
 //! Variable types of a signal in a VCD file.
 typedef enum {
@@ -101,6 +506,7 @@ typedef struct vcdscope VCDScope;
 //! Represents a single signal reference within a VCD file
 typedef struct {
     VCDSignalHash       hash;
+    VCDSignalHandle     handle;
     std::string         reference;
     VCDScope          * scope;
     VCDSignalSize       size;
@@ -114,6 +520,97 @@ struct vcdscope {
     VCDScope                * parent;   //!< Parent scope object
     std::vector<VCDScope*>    children; //!< Child scope objects.
     std::vector<VCDSignal*>   signals;  //!< Signals in this scope.
+    uint32_t                  node;     //!< Node in the VCDPathIndex.
+};
+
+/*!
+@brief Index of the hierarchical paths of the scopes and signals of a file.
+@details A path is made of the scope names below $root and the signal
+reference, joined by '/', as VCDFile::signal_path builds it. Every distinct
+name is stored once in a pool, and the tree of names lives in one array of
+nodes. Children are found through a hash table keyed by parent node and
+name, so looking up a path costs one probe per component. Scopes that are
+opened more than once share a node.
+*/
+class VCDPathIndex {
+public:
+    //! Number of a node, the root is 0.
+    typedef uint32_t Node;
+    //! Returned by lookups that find nothing.
+    static const Node NONE = (Node)-1;
+
+private:
+    typedef struct {
+        Node        parent;
+        uint32_t    name;       //!< Offset of the name in names.
+        Node        first_child;
+        Node        last_child;
+        Node        next;       //!< Next child of the parent.
+        VCDScope  * scope;      //!< First scope with this path, or nullptr.
+        VCDSignal * signal;     //!< First signal with this path, or nullptr.
+    } Entry;
+
+    std::vector<Entry>    nodes;
+    //! Distinct names, each followed by a 0.
+    std::vector<char>     names;
+    //! Open addressed tables of name offset + 1 and node, 0 is empty.
+    std::vector<uint32_t> name_slots;
+    std::vector<uint32_t> child_slots;
+    size_t                name_count;
+
+    static uint32_t hash_name(const char * name, size_t length);
+    static uint32_t hash_child(Node parent, uint32_t name);
+    //! Offset of a name in the pool, or NONE.
+    uint32_t find_name(const char * name, size_t length) const;
+    uint32_t add_name(const char * name, size_t length);
+    void grow_names();
+    void grow_children();
+    //! Child of parent with the given name, created if missing.
+    Node add_child(Node parent, const std::string & name);
+    //! Add the signals below node to out.
+    void collect(Node node, std::vector<VCDSignal*> & out) const;
+
+public:
+    VCDPathIndex();
+
+    /*!
+    @brief Match a path against a pattern where '*' matches any run of
+    characters, including '/', and '?' any single one.
+    */
+    static bool match(const char * pattern, const char * path);
+
+    //! Index a scope, its parent must have been added before.
+    void add_scope(VCDScope * scope);
+    //! Index a signal of a scope that has been added.
+    void add_signal(VCDSignal * signal);
+
+    //! Node of a path, or NONE. The empty path is the root.
+    Node find(const std::string & path) const;
+    VCDScope * get_scope(Node node) const {
+        return node < this->nodes.size() ? this->nodes[node].scope : nullptr;
+    }
+    VCDSignal * get_signal(Node node) const {
+        return node < this->nodes.size() ? this->nodes[node].signal : nullptr;
+    }
+    //! Last component of the path of node.
+    const char * get_name(Node node) const {
+        return &this->names[this->nodes[node].name];
+    }
+    //! Full path of node.
+    std::string get_path(Node node) const;
+    //! Add the signals at and below path to out, in declaration order.
+    void find_prefix(const std::string & path,
+                     std::vector<VCDSignal*> & out) const;
+    /*!
+    @brief Add the signals whose path matches pattern to out, see match.
+    @details A leading '/' in pattern is ignored, as it is by find.
+    */
+    void find_matching(const std::string & pattern,
+                       std::vector<VCDSignal*> & out) const;
+    //! Number of nodes, the root included.
+    size_t size() const {
+        return this->nodes.size();
+    }
 };
 
 /*!
@@ -127,8 +624,10 @@ class VCDValue {
     //! The actual value stored, as identified by type.
     union valstore {
         VCDBit         val_bit;   //!< Value as a bit
-        VCDBitVector * val_vector;//!< Value as a bit vector
+        VCDBitVector   val_vector;//!< Value as a bit vector
         VCDReal        val_real;  //!< Value as a real number (double).
+        valstore() {}
+        ~valstore() {}
     } value;
     //! Convert a VCDBit to a single char
     static char VCDBit2Char(VCDBit b) {
@@ -150,29 +649,713 @@ public:
         this->type = VCD_SCALAR;
         this->value.val_bit = value;
     }
-    VCDValue (VCDBitVector *  value) {
+    VCDValue (const VCDBitVector & value) {
         this->type = VCD_VECTOR;
-        this->value.val_vector= value;
+        new (&this->value.val_vector) VCDBitVector(value);
+    }
+    VCDValue (VCDBitVector && value) {
+        this->type = VCD_VECTOR;
+        new (&this->value.val_vector) VCDBitVector(std::move(value));
     }
     VCDValue (VCDReal value) {
         this->type = VCD_REAL;
         this->value.val_real = value;
     }
-    VCDValueType   get_type() {
+    VCDValue (const VCDValue & other) {
+        this->type = other.type;
+        if(this->type == VCD_VECTOR)
+            new (&this->value.val_vector) VCDBitVector(other.value.val_vector);
+        else if(this->type == VCD_SCALAR)
+            this->value.val_bit = other.value.val_bit;
+        else
+            this->value.val_real = other.value.val_real;
+    }
+    VCDValue & operator= (const VCDValue & other) {
+        if(this != &other) {
+            this->~VCDValue();
+            new (this) VCDValue(other);
+        }
+        return *this;
+    }
+    /*!
+    @brief Replace the contents with a copy of other that owns no memory,
+    taking the planes of wide vectors from arena.
+    */
+    void place(const VCDValue & other, VCDArena & arena) {
+        this->~VCDValue();
+        this->type = other.type;
+        if(this->type == VCD_VECTOR) {
+            new (&this->value.val_vector) VCDBitVector();
+            this->value.val_vector.place(other.value.val_vector, arena);
+        } else if(this->type == VCD_SCALAR) {
+            this->value.val_bit = other.value.val_bit;
+        } else {
+            this->value.val_real = other.value.val_real;
+        }
+    }
+    VCDValueType   get_type() const {
         return this->type;
     }
-    VCDBit       get_value_bit() {
+    /*!
+    @brief True if the type and, for a scalar, the bit are ones that are
+    defined.
+    @details For checking byte copies read back from a cache file. The enums
+    are read as integers, the compiler may assume an enum is in range.
+    */
+    bool well_formed() const {
+        std::underlying_type<VCDValueType>::type type;
+        std::underlying_type<VCDBit>::type       bit;
+        std::memcpy(&type, &this->type, sizeof(type));
+        std::memcpy(&bit, &this->value.val_bit, sizeof(bit));
+        return type <= VCD_REAL && (type != VCD_SCALAR || bit <= VCD_Z);
+    }
+    VCDBit       get_value_bit() const {
         return this->value.val_bit;
     }
     VCDBitVector * get_value_vector() {
-        return this->value.val_vector;
+        return &this->value.val_vector;
     }
-    VCDReal      get_value_real() {
+    const VCDBitVector * get_value_vector() const {
+        return &this->value.val_vector;
+    }
+    VCDReal      get_value_real() const {
         return this->value.val_real;
     }
+    //! True if other has the same type and value.
+    bool operator==(const VCDValue & other) const {
+        if(this->type != other.type)
+            return false;
+        switch(this->type) {
+        case VCD_SCALAR:
+            return this->value.val_bit == other.value.val_bit;
+        case VCD_VECTOR:
+            return this->value.val_vector == other.value.val_vector;
+        default:
+            return this->value.val_real == other.value.val_real;
+        }
+    }
+    bool operator!=(const VCDValue & other) const {
+        return !(*this == other);
+    }
     ~VCDValue () {
         if(this->type == VCD_VECTOR)
-            delete this->value.val_vector;
+            this->value.val_vector.~VCDBitVector();
+    }
+};
+
+/*!
+@brief A list of times stored as the varint encoded differences between
+neighbours.
+@details Every BLOCK entries start a block whose first time is kept in full,
+so finding the i'th time decodes at most BLOCK - 1 differences and finding a
+time is a binary search over the blocks. Differences are zigzag encoded, so
+times that go backwards are kept exactly as well.
+*/
+class VCDTimeList {
+public:
+    //! Entries per block.
+    static const uint32_t BLOCK = 64;
+    //! Longest encoded difference.
+    static const unsigned MAX_DELTA = 10;
+
+    //! Write the difference from prev to time at out, returns its end.
+    static uint8_t * encode(uint8_t * out, VCDTime prev, VCDTime time) {
+        uint64_t diff = time - prev;
+        uint64_t zz   = (diff << 1) ^ (uint64_t)((int64_t)diff >> 63);
+        while(zz >= 0x80) {
+            *out++ = (uint8_t)zz | 0x80;
+            zz >>= 7;
+        }
+        *out++ = (uint8_t)zz;
+        return out;
+    }
+    //! Read a difference written by encode and add it to prev.
+    static VCDTime decode(const uint8_t *& in, VCDTime prev) {
+        uint64_t zz = *in++;
+        if(zz >= 0x80) {
+            zz &= 0x7f;
+            unsigned shift = 7;
+            uint8_t  byte;
+            do {
+                byte   = *in++;
+                zz    |= (uint64_t)(byte & 0x7f) << shift;
+                shift += 7;
+            } while(byte >= 0x80);
+        }
+        return prev + ((zz >> 1) ^ (0 - (zz & 1)));
+    }
+
+private:
+    //! Start of a block.
+    typedef struct {
+        VCDTime  first;  //!< Time of the first entry.
+        uint64_t offset; //!< Position in bytes of the second entry.
+    } Block;
+
+    std::vector<Block>   blocks;
+    std::vector<uint8_t> bytes;
+    size_t               count;
+    VCDTime              last;
+
+public:
+    //! Walks the times in order.
+    class const_iterator {
+        const VCDTimeList * list;
+        size_t              index;
+        const uint8_t     * next;
+        VCDTime             time;
+
+        void load() {
+            if(this->index % BLOCK == 0 && this->index < this->list->count) {
+                const Block & block = this->list->blocks[this->index / BLOCK];
+                this->time = block.first;
+                this->next = this->list->bytes.data() + block.offset;
+            }
+        }
+    public:
+        const_iterator(const VCDTimeList * list, size_t index) :
+            list(list), index(index), next(nullptr), time(0) {
+            load();
+        }
+        VCDTime operator*() const {
+            return this->time;
+        }
+        const_iterator & operator++() {
+            if(++this->index % BLOCK == 0)
+                load();
+            else if(this->index < this->list->count)
+                this->time = decode(this->next, this->time);
+            return *this;
+        }
+        bool operator!=(const const_iterator & other) const {
+            return this->index != other.index;
+        }
+        bool operator==(const const_iterator & other) const {
+            return this->index == other.index;
+        }
+    };
+
+    VCDTimeList() : count(0), last(0) {}
+
+    void push_back(VCDTime time) {
+        if(this->count % BLOCK == 0) {
+            Block block = {time, this->bytes.size()};
+            this->blocks.push_back(block);
+        } else {
+            uint8_t buffer[MAX_DELTA];
+            this->bytes.insert(this->bytes.end(), buffer,
+                               encode(buffer, this->last, time));
+        }
+        this->last = time;
+        this->count++;
+    }
+    //! Add all times of other to the end.
+    void append(const VCDTimeList & other) {
+        for(VCDTime time : other)
+            push_back(time);
+    }
+    void clear() {
+        this->blocks.clear();
+        this->bytes.clear();
+        this->count = 0;
+        this->last  = 0;
+    }
+    size_t size() const {
+        return this->count;
+    }
+    bool empty() const {
+        return this->count == 0;
+    }
+    //! The latest time, the list must not be empty.
+    VCDTime back() const {
+        return this->last;
+    }
+    //! The i'th time.
+    VCDTime operator[](size_t i) const;
+    //! Index of the first time not before time, for a sorted list.
+    size_t lower_bound(VCDTime time) const;
+    //! Bytes used by the encoded times.
+    size_t memory() const {
+        return this->bytes.capacity() +
+               this->blocks.capacity() * sizeof(Block);
+    }
+    const_iterator begin() const {
+        return const_iterator(this, 0);
+    }
+    const_iterator end() const {
+        return const_iterator(this, this->count);
+    }
+};
+
+/*!
+@brief One block of a signal's history: a run of times and the values that
+changed at them.
+@details The first and last times are kept in full, the others as
+VCDTimeList::encode differences from their predecessor in deltas.
+*/
+typedef struct vcdvalueblock {
+    struct vcdvalueblock * next;       //!< Next block in time order.
+    uint32_t               count;      //!< Entries used.
+    uint32_t               capacity;   //!< Entries allocated.
+    VCDTime                first;      //!< Time of the first entry.
+    VCDTime                last;       //!< Time of the last entry.
+    uint8_t              * deltas;     //!< Times of the other entries.
+    uint32_t               delta_size; //!< Bytes used in deltas.
+    uint32_t               delta_room; //!< Bytes allocated for deltas.
+    VCDValue             * values;     //!< Value of each entry.
+} VCDValueBlock;
+
+/*!
+@brief The values of a single signal, sorted by time.
+@details Stored column-wise in a list of VCDValueBlock allocated from the
+VCDFile arena, so neither the blocks nor the values are freed one by one.
+Iterating yields VCDTimedValue records whose value points into the block.
+*/
+class VCDSignalValues {
+    //! First block, nullptr until a value is added.
+    VCDValueBlock * head;
+    //! Block new values are appended to.
+    VCDValueBlock * tail;
+    //! Total number of values in all blocks.
+    size_t          count;
+public:
+    //! Entries in the first block, later blocks double up to MAX_BLOCK.
+    static const uint32_t MIN_BLOCK = 4;
+    //! Bytes of deltas allocated per entry, when the history so far
+    //! gives no better estimate.
+    static const uint32_t DELTA_BYTES = 2;
+    //! Largest number of entries in a block.
+    static const uint32_t MAX_BLOCK = 1024;
+
+    //! Walks the values in time order.
+    class iterator {
+        VCDValueBlock * block;
+        uint32_t        index;
+        //! Encoded time of the next entry in block.
+        const uint8_t * next;
+        VCDTimedValue   current;
+
+        void load() {
+            if(block) {
+                current.time = block->first;
+                next         = block->deltas;
+            }
+        }
+    public:
+        iterator(VCDValueBlock * block, uint32_t index) :
+            block(block), index(index), next(nullptr) {
+            current.time = 0;
+            load();
+        }
+        VCDTimedValue operator*() {
+            current.value = &block->values[index];
+            return current;
+        }
+        VCDTimedValue * operator->() {
+            **this;
+            return &current;
+        }
+        iterator & operator++() {
+            if(++index == block->count) {
+                block = block->next;
+                index = 0;
+                load();
+            } else {
+                current.time = VCDTimeList::decode(next, current.time);
+            }
+            return *this;
+        }
+        bool operator==(const iterator & other) const {
+            return block == other.block && index == other.index;
+        }
+        bool operator!=(const iterator & other) const {
+            return !(*this == other);
+        }
+    };
+
+    VCDSignalValues() : head(nullptr), tail(nullptr), count(0) {}
+
+    //! Append a value, copying it into storage taken from arena.
+    void push_back(VCDArena & arena, VCDTime time, const VCDValue & value);
+
+    iterator begin() const {
+        return iterator(this->head, 0);
+    }
+    iterator end() const {
+        return iterator(nullptr, 0);
+    }
+    size_t size() const {
+        return this->count;
+    }
+    bool empty() const {
+        return this->count == 0;
+    }
+    //! The i'th value in time order.
+    VCDTimedValue operator[](size_t i) const;
+    //! First block, nullptr if there are no values.
+    const VCDValueBlock * first_block() const {
+        return this->head;
+    }
+    //! Link a block of later values onto the end, it is not copied.
+    void append(VCDValueBlock * block) {
+        block->next = nullptr;
+        if(this->tail)
+            this->tail->next = block;
+        else
+            this->head = block;
+        this->tail   = block;
+        this->count += block->count;
+    }
+    //! Move the values of other, which are all later, onto the end.
+    void append(VCDSignalValues & other) {
+        if(!other.head)
+            return;
+        if(this->tail)
+            this->tail->next = other.head;
+        else
+            this->head = other.head;
+        this->tail   = other.tail;
+        this->count += other.count;
+        other.head   = nullptr;
+        other.tail   = nullptr;
+        other.count  = 0;
+    }
+    //! The most recent value.
+    VCDTimedValue back() const {
+        VCDTimedValue tv;
+        tv.time  = this->tail->last;
+        tv.value = &this->tail->values[this->tail->count - 1];
+        return tv;
+    }
+};
+
+/*!
+@brief The values of a single signal, compressed, see
+VCDFile::set_compressed.
+@details A value equal to the one kept before it is dropped, so only real
+changes are stored. Each change is a varint holding the zigzag encoded time
+difference from the previous change, shifted left by three, and a tag in
+the low three bits, followed by the payload of the tag:
+
+- TAG_BIT + b: the scalar VCDBit b, no payload.
+- TAG_REF: a varint index into the dictionary.
+- TAG_KNOWN: a vector without X or Z bits, its width as a varint followed
+  by the bytes of its value plane.
+- TAG_VECTOR: as TAG_KNOWN, followed by the bytes of the xz plane.
+- TAG_REAL: the 8 bytes of a VCDReal.
+
+The first DICTIONARY_SIZE distinct vector and real values are entered in a
+dictionary the first time they are seen, which keeps the offset of their
+change. Later changes to one of them are a TAG_REF, so an idle bus or a
+state machine costs a byte or two per change.
+
+Changes are grouped into blocks of at most BLOCK changes whose first time is
+kept in full and whose first change has a zero difference, so value_at is a
+binary search over the blocks and a scan of one of them. Values are only
+decoded on access.
+*/
+class VCDHistory {
+public:
+    //! Largest number of changes in a block.
+    static const uint32_t BLOCK = 64;
+    //! Largest number of distinct values in the dictionary.
+    static const uint32_t DICTIONARY_SIZE = 256;
+
+    enum {
+        TAG_BIT    = 0,
+        TAG_REF    = 4,
+        TAG_KNOWN  = 5,
+        TAG_VECTOR = 6,
+        TAG_REAL   = 7
+    };
+
+private:
+    //! Start of a block.
+    typedef struct {
+        VCDTime  first;  //!< Time of the first change.
+        uint64_t offset; //!< Position in bytes of the first change.
+        uint64_t index;  //!< Number of changes before the block.
+    } Block;
+
+    //! Values seen more than once are likely to come again.
+    typedef struct {
+        //! Position in bytes of the first change to each value.
+        std::vector<uint64_t> offsets;
+        //! Hash of the tag and payload of each value.
+        std::vector<uint32_t> hashes;
+        //! Open addressed table of index + 1 by hash, 0 when free.
+        std::vector<uint16_t> slots;
+    } Dictionary;
+
+    std::vector<Block>   blocks;
+    std::vector<uint8_t> bytes;
+    //! Created with the first vector or real.
+    Dictionary         * dictionary;
+    size_t               count;
+    //! Changes in the last block.
+    uint32_t             block_count;
+    VCDTime              last;
+    //! Tag, dictionary index and payload of the last change, to drop
+    //! repeats.
+    unsigned             last_tag;
+    uint32_t             last_code;
+    uint64_t             last_payload;
+    //! Payload being encoded.
+    std::vector<uint8_t> payload;
+
+    //! Dictionary index of the value in payload, adding it if there is room.
+    uint32_t intern(unsigned tag, uint64_t offset, bool & added);
+    //! Past the payload of a change with tag at p.
+    const uint8_t * skip(const uint8_t * p, unsigned tag) const;
+    //! Decode the payload of a change with tag at p into value.
+    void decode(const uint8_t * p, unsigned tag, VCDValue & value) const;
+
+public:
+    //! Not a dictionary index.
+    static const uint32_t NO_CODE = 0xffffffff;
+
+    /*!
+    @brief Walks the changes in time order.
+    @details The value is decoded into the iterator and is valid until it
+    moves. push_back invalidates iterators. Only begin, end and lower_bound
+    make them.
+    */
+    class const_iterator {
+        friend class VCDHistory;
+
+        const VCDHistory * history;
+        size_t             index;
+        size_t             block;
+        const uint8_t    * next;
+        VCDTime            time;
+        VCDValue           value;
+
+        //! Decode the change at next.
+        void load();
+        //! At the first change of block.
+        const_iterator(const VCDHistory * history, size_t index,
+                       size_t block);
+    public:
+        const_iterator(const VCDHistory * history, size_t index);
+        //! Number of changes before this one.
+        size_t position() const {
+            return this->index;
+        }
+        VCDTimedValue operator*() {
+            VCDTimedValue tv = {this->time, &this->value};
+            return tv;
+        }
+        const_iterator & operator++() {
+            if(++this->index < this->history->count)
+                load();
+            return *this;
+        }
+        bool operator!=(const const_iterator & other) const {
+            return this->index != other.index;
+        }
+        bool operator==(const const_iterator & other) const {
+            return this->index == other.index;
+        }
+    };
+
+    VCDHistory() : dictionary(nullptr), count(0), block_count(0), last(0),
+        last_tag(0), last_code(NO_CODE), last_payload(0) {}
+    ~VCDHistory() {
+        delete this->dictionary;
+    }
+
+    //! Append a change, unless value is the value kept last.
+    void push_back(VCDTime time, const VCDValue & value);
+    //! Number of changes kept.
+    size_t size() const {
+        return this->count;
+    }
+    bool empty() const {
+        return this->count == 0;
+    }
+    /*!
+    @brief Decode the value in force at time into value.
+    @param since Set to the time of the change, unless nullptr.
+    @returns false if the signal has no value yet at time.
+    */
+    bool value_at(VCDTime time, VCDValue & value,
+                  VCDTime * since = nullptr) const;
+    //! Append every change to values, storage taken from arena.
+    void expand(VCDSignalValues & values, VCDArena & arena) const;
+    //! Append the changes of other, which come after the ones kept.
+    void append(const VCDHistory & other);
+    //! Release the room kept for further changes.
+    void shrink();
+    //! Bytes used.
+    size_t memory() const;
+    const_iterator begin() const {
+        return const_iterator(this, 0);
+    }
+    const_iterator end() const {
+        return const_iterator(this, this->count);
+    }
+    //! The first change not before time.
+    const_iterator lower_bound(VCDTime time) const;
+};
+
+/*!
+@brief The state of a VCD file at one of its timestamps, see
+VCDCheckpointIndex.
+*/
+typedef struct {
+    VCDTime    time;   //!< Time of the timestamp.
+    uint64_t   offset; //!< Byte offset of its '#' in the file.
+    VCDValue * values; //!< Value of each handle in force before the timestamp.
+    uint8_t  * known;  //!< Nonzero for the handles that had a value by then.
+} VCDCheckpoint;
+
+/*!
+@brief Checkpoints taken at regular time intervals through a VCD file, so
+parsing can resume part way through it.
+@details Built by VCDFileParser::build_index and used by
+VCDFileParser::seek_file and VCDFileParser::seek_stream. The values of each
+checkpoint are kept in an arena owned by the index.
+*/
+class VCDCheckpointIndex {
+    //! Storage of the checkpoint values.
+    VCDArena arena;
+public:
+    //! Checkpoints in time order.
+    std::vector<VCDCheckpoint> checkpoints;
+    //! Number of handles in each checkpoint.
+    size_t   handle_count;
+    //! Minimum time between checkpoints.
+    VCDTime  interval;
+    //! Size of the indexed file.
+    uint64_t source_size;
+    //! Modification time of the indexed file, seconds and nanoseconds.
+    int64_t  source_mtime;
+    int64_t  source_mtime_ns;
+
+    VCDCheckpointIndex() : handle_count(0), interval(0), source_size(0),
+        source_mtime(0), source_mtime_ns(0) {}
+
+    //! Add a checkpoint holding copies of values.
+    void add(VCDTime time, uint64_t offset, const VCDValue * values,
+             const uint8_t * known);
+    //! The last checkpoint at or before time, nullptr if there is none.
+    const VCDCheckpoint * find(VCDTime time) const;
+    //! True if the index was built from sourcepath as it is now.
+    bool matches(const std::string & sourcepath) const;
+    //! Record the size and modification time of sourcepath.
+    bool set_source(const std::string & sourcepath);
+
+    //! Save the index to path. @returns false on failure.
+    bool write(const std::string & path) const;
+    /*!
+    @brief Load an index saved by write into this empty one.
+    @details Counts and widths are checked against the size of the file
+    before anything is allocated for them.
+    @returns false if path cannot be read or is not an index, leaving this
+    index unchanged.
+    */
+    bool read(const std::string & path);
+};
+
+/*!
+@brief Decompresses a gzip or xz file on its own thread into a ring of large
+buffers, so decompression overlaps with decoding.
+@details Offsets are positions in the decompressed data. Multi-block xz
+files, as written by xz -T, restart at the block holding an offset; other
+files are decompressed from the start and the data before it discarded.
+*/
+class VCDInputPipe {
+public:
+    //! Size of each buffer in the ring.
+    static const size_t   BUFFER_SIZE  = 16 << 20;
+    //! Number of buffers in the ring.
+    static const unsigned BUFFER_COUNT = 4;
+
+    /*!
+    @brief Open filepath if it starts with a gzip or xz header.
+    @returns nullptr if it does not or cannot be opened.
+    */
+    static VCDInputPipe * open(const std::string & filepath);
+    ~VCDInputPipe();
+
+    //! (Re)start decompressing, the first buffer begins at offset.
+    void start(uint64_t offset);
+    /*!
+    @brief Wait for the next buffer, valid until release is called.
+    @param origin Set to the offset of data.
+    @returns false once the data is exhausted.
+    */
+    bool next(const char *& data, size_t & size, uint64_t & origin);
+    //! Hand the buffer returned by next back to the decompressing thread.
+    void release();
+    //! True if the file could not be read or decompressed.
+    bool failed() {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return this->error;
+    }
+
+private:
+    //! Decoder state of the compression format.
+    struct Codec;
+
+    VCDInputPipe(FILE * in, Codec * codec);
+    //! Body of the decompressing thread.
+    void run();
+    //! Stop the decompressing thread and wait for it.
+    void stop();
+
+    FILE                  * in;
+    Codec                 * codec;
+    std::thread             worker;
+    std::mutex              lock;
+    //! Signalled whenever a buffer is filled or released.
+    std::condition_variable changed;
+    char                  * buffers[BUFFER_COUNT];
+    //! Data of each buffer, from begin to begin + size.
+    size_t                  begins[BUFFER_COUNT];
+    size_t                  sizes[BUFFER_COUNT];
+    uint64_t                origins[BUFFER_COUNT];
+    //! Buffers filled, handed out by next and released, since start.
+    uint64_t                filled;
+    uint64_t                taken;
+    uint64_t                released;
+    //! Offset the current run was started at.
+    uint64_t                start_offset;
+    bool                    finished;
+    bool                    stopping;
+    bool                    error;
+};
+
+/*!
+@brief Timestamps and values decoded from one byte range of the value change
+section, to be appended to a VCDFile with VCDFile::append_values.
+*/
+class VCDValueRange {
+public:
+    //! Storage of the values.
+    VCDArena                     arena;
+    //! Values of each signal in the range, indexed by handle.
+    std::vector<VCDSignalValues> values;
+    //! Timestamps in the range.
+    VCDTimeList                  times;
+    //! Time in force at the end of the range.
+    VCDTime                      end_time;
+    //! Reused to decode vector values.
+    VCDValue                     vector_value;
+    //! Values of each signal, compressed, instead of values and arena when
+    //! the file is compressed.
+    std::vector<VCDHistory*>     histories;
+
+    VCDValueRange(size_t handles, bool compressed) :
+        values(compressed ? 0 : handles), end_time(0),
+        vector_value(VCDBitVector()) {
+        if(compressed)
+            for(size_t h = 0; h < handles; h++)
+                this->histories.push_back(new VCDHistory());
+    }
+    ~VCDValueRange() {
+        for(VCDHistory * history : this->histories)
+            delete history;
     }
 };
 
@@ -186,11 +1369,60 @@ class VCDFile {
     //! Flat mao of all scope objects in the file, keyed by name.
     std::vector<VCDScope*>  scopes;
     //! Vector of time values present in the VCD file - sorted, asc
-    std::vector<VCDTime>    times;
-    //! Map of hashes onto vectors of times and signal values.
-    std::map<VCDSignalHash, VCDSignalValues*> val_map;
+    VCDTimeList             times;
+    //! Times and signal values of each signal, indexed by handle.
+    std::vector<VCDSignalValues*> val_map;
+    //! Declared size of each handle, the largest of its signals.
+    std::vector<VCDSignalSize>    handle_sizes;
+    //! Storage of the val_map entries and all of their values.
+    VCDArena                      arena;
+    //! Paths of all scopes and signals.
+    VCDPathIndex                  paths;
+    //! Handles of short identifier codes, indexed by decode_idcode().
+    std::vector<VCDSignalHandle>  idcode_handles;
+    //! Handles of identifier codes that do not fit idcode_handles.
+    std::map<VCDSignalHash, VCDSignalHandle> long_idcode_handles;
+    //! Mapping of the cache file values are served from, or nullptr.
+    void                        * cache_base;
+    //! Size in bytes of the mapping at cache_base.
+    size_t                        cache_size;
+    //! File the arena is spilled to, or nullptr, see set_memory_budget.
+    VCDSpill                    * spill;
+    //! True once set_compressed was called.
+    bool                          compressed;
+    //! Compressed values of each handle, see set_compressed.
+    std::vector<VCDHistory*>      histories;
+    //! Handles whose histories have been expanded into val_map.
+    std::vector<bool>             expanded;
+    //! Serialises expand.
+    std::mutex                    expand_lock;
+    //! Expand the history of handle into val_map, once.
+    void expand(VCDSignalHandle handle);
+    //! Release the mapping made by read_cache.
+    void unmap_cache();
+
+    //! Longest identifier code looked up through idcode_handles.
+    static const size_t IDCODE_DIGITS = 6;
+    /*!
+    @brief Decode a short identifier code into an integer.
+    @details Codes are read as base 94 numbers over the printable characters
+    '!' to '~', first character least significant, which is how simulators
+    hand them out. Sequentially allocated codes therefore decode to a dense
+    range of integers.
+    */
+    static uint64_t decode_idcode(const char * id, size_t len) {
+        uint64_t code = 0;
+        while(len--)
+            code = code * 94 + (uint8_t)(id[len] - ' ');
+        return code;
+    }
+    //! Handle of a code that is not in idcode_handles.
+    VCDSignalHandle get_long_handle(const char * id, size_t len) const;
+    //! Assign the next free handle to an identifier code.
+    VCDSignalHandle add_handle(const VCDSignalHash & hash);
 public:
-    VCDFile(){ }
+    VCDFile() : cache_base(nullptr), cache_size(0), spill(nullptr),
+        compressed(false), root_scope(nullptr) { }
     ~VCDFile(){
         // Delete signals and scopes.
         for (VCDScope * scope : this->scopes) {
@@ -198,13 +1430,11 @@ public:
                 delete signal;
             delete scope;
         }
-        for(auto hash_val = this->val_map.begin(); hash_val != this->val_map.end(); ++hash_val) {
-            for(auto vals = hash_val->second->begin(); vals != hash_val->second->end(); ++vals) {
-                delete (*vals)->value;
-                delete *vals;
-            }
-            delete hash_val->second;
-        }
+        // Signal values live in the arena and go with it, or in the cache.
+        unmap_cache();
+        delete this->spill;
+        for (VCDHistory * history : this->histories)
+            delete history;
     }
     //! Timescale of the VCD file.
     VCDTimeUnit time_units;
@@ -228,14 +1458,90 @@ public:
     void add_signal( VCDSignal * s);
     /*!
     @brief Add a new signal value to the VCD file, tagged by time.
-    @param time_val in - A signal value, tagged by the time it occurs.
-    @param hash in - The VCD hash value representing the signal.
+    @param handle in - The handle of the signal, see get_handle.
+    @param time in - The time the value changed.
+    @param value in - The new value, copied into the file.
+    */
+    void add_signal_value( VCDSignalHandle handle, VCDTime time,
+                           const VCDValue & value);
+    /*!
+    @brief Forget the identifier codes of the handles that are not
+    selected, so their value changes are skipped.
+    @param selected Indexed by handle.
+    */
+    void select_handles(const std::vector<bool> & selected);
+    /*!
+    @brief Path of a signal: the names of its enclosing scopes below $root
+    and its reference, joined by '/'.
+    */
+    static std::string signal_path(const VCDSignal * signal);
+    /*!
+    @brief Look up the handle of a declared identifier code.
+    @returns VCD_HANDLE_NONE if no $var declared the code or its handle was
+    dropped by select_handles.
+    */
+    VCDSignalHandle get_handle(const char * id, size_t len) const {
+        if(len <= IDCODE_DIGITS) {
+            uint64_t code = decode_idcode(id, len);
+            if(code < this->idcode_handles.size() &&
+               this->idcode_handles[code] != VCD_HANDLE_NONE)
+                return this->idcode_handles[code];
+        }
+        return get_long_handle(id, len);
+    }
+    VCDSignalHandle get_handle(const VCDSignalHash & hash) const {
+        return get_handle(hash.c_str(), hash.size());
+    }
+    //! Number of distinct handles, one per declared identifier code.
+    size_t get_handle_count() const {
+        return this->val_map.size();
+    }
+    //! Declared size of the signals with the given handle.
+    VCDSignalSize get_handle_size(VCDSignalHandle handle) const {
+        return this->handle_sizes[handle];
+    }
+    /*!
+    @brief Times and values of the signal with the given handle.
+    @details When the file is compressed, the history of the handle is
+    expanded on the first call and kept. get_history reads it without
+    expanding.
+    */
+    VCDSignalValues * get_signal_values(VCDSignalHandle handle) {
+        if(this->compressed)
+            expand(handle);
+        return this->val_map[handle];
+    }
+    //! Compressed values of the handle, nullptr if not set_compressed.
+    const VCDHistory * get_history(VCDSignalHandle handle) const {
+        return this->compressed ? this->histories[handle] : nullptr;
+    }
+    //! True once set_compressed was called.
+    bool is_compressed() const {
+        return this->compressed;
+    }
+    //! Number of values of the handle, without expanding its history.
+    size_t get_value_count(VCDSignalHandle handle) const {
+        return this->compressed ? this->histories[handle]->size() :
+                                  this->val_map[handle]->size();
+    }
+    /*!
+    @brief Scope with the given path, see VCDPathIndex.
+    @details "" and the name of the root scope, "$root", give the root.
     */
-    void add_signal_value( VCDTimedValue * time_val, VCDSignalHash   hash); 
     VCDScope * get_scope( std::string  name) {
-        return nullptr;
-    } 
-    std::vector<VCDTime>* get_timestamps() {
+        if(this->root_scope && name == this->root_scope->name)
+            return this->root_scope;
+        return this->paths.get_scope(this->paths.find(name));
+    }
+    //! Signal with the given path, or nullptr.
+    VCDSignal * get_signal(const std::string & path) {
+        return this->paths.get_signal(this->paths.find(path));
+    }
+    //! Index of the paths of all scopes and signals.
+    const VCDPathIndex & get_paths() const {
+        return this->paths;
+    }
+    VCDTimeList* get_timestamps() {
         return &this->times;
     } 
     std::vector<VCDScope*>* get_scopes() {
@@ -247,6 +1553,493 @@ public:
     void add_timestamp( VCDTime time) {
         this->times.push_back(time);
     }
+
+    /*!
+    @brief Append values decoded from a later range of the file.
+    @details The value blocks and the arena holding them are taken over,
+    nothing is copied.
+    */
+    void append_values(VCDValueRange & range);
+
+    /*!
+    @brief Keep at most budget bytes of the values added from now on in
+    memory, spilling the rest to a temporary file in directory.
+    @details See VCDSpill. Values are read back transparently when they
+    are used, so nothing else changes. Only the value storage counts
+    towards the budget, declarations and timestamps come on top.
+    @returns false if the file cannot be created.
+    */
+    bool set_memory_budget(size_t budget, const std::string & directory);
+    //! The file of set_memory_budget, nullptr if there is none.
+    VCDSpill * get_spill() {
+        return this->spill;
+    }
+
+    /*!
+    @brief Keep the values added from now on compressed, as a VCDHistory
+    per handle.
+    @details Repeated values are dropped. Call before any value is added.
+    */
+    void set_compressed();
+    //! Release the room kept for more values in each history.
+    void shrink_histories();
+
+    /*!
+    @brief Save the file as a binary cache of sourcepath.
+    @details The cache holds the scopes, signals, timestamps and the value
+    columns of each signal. It is tagged with the size and modification
+    time of sourcepath so read_cache can tell when it is out of date.
+    @returns false if the cache could not be written.
+    */
+    bool write_cache(const std::string & cachepath,
+                     const std::string & sourcepath);
+    /*!
+    @brief Load an empty VCDFile from a cache made by write_cache.
+    @details The cache is memory mapped and the values are used in place.
+    @returns false if the cache is missing, does not match sourcepath in
+    size and modification time, or was written by an incompatible build.
+    */
+    bool read_cache(const std::string & cachepath,
+                    const std::string & sourcepath);
+};
+
+//! Kind of transition looked for by VCDQuery edge scans.
+typedef enum {
+    VCD_EDGE_RISING,  //!< 0 to X, Z or 1, or X or Z to 1, as posedge.
+    VCD_EDGE_FALLING, //!< 1 to X, Z or 0, or X or Z to 0, as negedge.
+    VCD_EDGE_ANY      //!< Any change of value.
+} VCDEdge;
+
+/*!
+@brief A value to compare signal values against, with don't care bits.
+@details Written like a VCD binary value: 0, 1, x/X, z/Z and ? for a bit
+that matches anything, leftmost bit first, '_' is skipped. Patterns and
+values narrower than each other are extended the way VCD extends values:
+with the leftmost bit if it is X, Z or ?, and with 0 otherwise. Scalars
+compare as one bit vectors, reals never match.
+*/
+class VCDPattern {
+    //! Value plane, xz plane and care mask of each word, least significant
+    //! word first, then the same three for the bits above the pattern.
+    std::vector<uint64_t> planes;
+    //! Number of bits given.
+    VCDSignalSize         width;
+public:
+    VCDPattern(const std::string & text);
+    //! True if value has the pattern's bits wherever it cares.
+    bool matches(const VCDValue & value) const;
+};
+
+/*!
+@brief Point lookups and range scans over the histories of a parsed file.
+@details A directory of every SKIP'th value of each signal is built up
+front, so finding the value in force at a time is a binary search and the
+decoding of at most SKIP - 1 time differences. Range scans evaluate their
+predicate on 64 values at a time, gathering one bit of each value into a
+word and combining whole words, and only decode the times of values they
+report.
+
+Queries are const and may run on several threads at once. The batch
+queries spread their signals over the threads member. Values appended to
+the file after the directory was built are not seen.
+
+On a file kept compressed, see VCDFile::set_compressed, no directory is
+built and queries read the VCDHistory of each signal, so nothing is
+expanded. The histories hold no repeated values, so count_values counts
+changes and find_matches reports only the first of repeated matching
+values, while find_edges gives the same results as on the plain file.
+value_at decodes into storage passed by the caller.
+*/
+class VCDQuery {
+public:
+    //! Values between directory entries.
+    static const uint32_t SKIP = 64;
+
+private:
+    //! Directory entry: a value and where its successor's time is encoded.
+    typedef struct {
+        VCDTime               time;     //!< Time of the value.
+        const VCDValueBlock * block;    //!< Block holding the value.
+        uint32_t              index;    //!< Position in block.
+        uint32_t              offset;   //!< Bytes into block->deltas of the
+                                        //!< next time.
+        uint64_t              position; //!< Position in the whole history.
+    } Mark;
+
+    //! Position within a history while scanning.
+    typedef struct {
+        const VCDValueBlock * block;
+        uint32_t              index;
+        const uint8_t       * next;     //!< Encoded time of the next entry.
+        VCDTime               time;
+        uint64_t              position;
+        const VCDValue      * prev;     //!< Value before the cursor, if
+                                        //!< found by seek.
+        VCDTime               prev_time;
+    } Cursor;
+
+    VCDFile               * file;
+    //! Directory entries of all signals, grouped by handle.
+    std::vector<Mark>       marks;
+    //! Start of each handle's entries in marks, and the end of the last.
+    std::vector<size_t>     mark_begin;
+
+    //! Fill in the directory entries of one handle.
+    void build(VCDSignalHandle handle);
+    //! Cursor at the first value of handle not before time.
+    Cursor seek(VCDSignalHandle handle, VCDTime time) const;
+    //! Move cursor forward by count values.
+    static void advance(Cursor & cursor, uint64_t count);
+    /*!
+    @brief Scan the values of handle from t0 to t1 inclusive, 64 at a time.
+    @details select sets bit i of its result for each of the count values
+    from values that is reported, given the value before the first one,
+    which is X at the start of the history. Reported values are counted,
+    and their times added to out unless it is nullptr.
+    */
+    template<class Select>
+    size_t scan(VCDSignalHandle handle, VCDTime t0, VCDTime t1,
+                Select select, std::vector<VCDTime> * out) const;
+    //! scan over a compressed history.
+    template<class Select>
+    size_t scan_history(const VCDHistory * history, VCDTime t0, VCDTime t1,
+                        Select select, std::vector<VCDTime> * out) const;
+    //! Call fn for each of count items, spread over the threads.
+    void run(size_t count, const std::function<void(size_t)> & fn) const;
+
+public:
+    /*!
+    @brief Build the directory of every signal of file.
+    @param threads in - Threads to build with and run batch queries on, 0
+    for one per core.
+    */
+    VCDQuery(VCDFile * file, unsigned threads = 1);
+
+    //! Threads batch queries run on, 0 for one per core.
+    unsigned threads;
+
+    /*!
+    @brief The value of handle in force at time.
+    @details That is the last value stored at or before time. The value is
+    nullptr if the signal has no value by then. On a compressed file it is
+    decoded into storage and points there, otherwise it points into the
+    file and storage is left alone.
+    */
+    VCDTimedValue value_at(VCDSignalHandle handle, VCDTime time,
+                           VCDValue & storage) const;
+    //! Number of values handle has from t0 to t1 inclusive.
+    size_t count_values(VCDSignalHandle handle, VCDTime t0,
+                        VCDTime t1) const;
+    /*!
+    @brief Count the edges of handle from t0 to t1 inclusive.
+    @details Vectors have the edges of their least significant bit, except
+    for VCD_EDGE_ANY which compares whole values. Reals rise and fall
+    with their value. Before its first value a signal reads as X.
+    @param out in - If not nullptr, the time of each edge is added to it.
+    */
+    size_t find_edges(VCDSignalHandle handle, VCDEdge edge, VCDTime t0,
+                      VCDTime t1, std::vector<VCDTime> * out = nullptr) const;
+    /*!
+    @brief Count the values of handle from t0 to t1 inclusive that match
+    pattern.
+    @param out in - If not nullptr, the time of each match is added to it.
+    */
+    size_t find_matches(VCDSignalHandle handle, const VCDPattern & pattern,
+                        VCDTime t0, VCDTime t1,
+                        std::vector<VCDTime> * out = nullptr) const;
+
+    //! value_at for each of handles, into values, with storage for each.
+    void values_at(const std::vector<VCDSignalHandle> & handles, VCDTime time,
+                   std::vector<VCDTimedValue> & values,
+                   std::vector<VCDValue> & storage) const;
+    //! find_edges for each of handles, the counts go into counts.
+    void count_edges(const std::vector<VCDSignalHandle> & handles,
+                     VCDEdge edge, VCDTime t0, VCDTime t1,
+                     std::vector<size_t> & counts) const;
+    //! find_matches for each of handles, the counts go into counts.
+    void count_matches(const std::vector<VCDSignalHandle> & handles,
+                       const VCDPattern & pattern, VCDTime t0, VCDTime t1,
+                       std::vector<size_t> & counts) const;
+    /*!
+    @brief Call fn with each of handles, spread over the threads.
+    @details For queries not covered by the other batch calls. fn must be
+    safe to call from several threads at once.
+    */
+    void for_each(const std::vector<VCDSignalHandle> & handles,
+                  const std::function<void(VCDSignalHandle)> & fn) const;
+};
+
+/*!
+@brief Receives the contents of a VCD file while it is parsed.
+@details Passed to VCDFileParser::parse_stream, which calls these in file
+order and keeps no value history, so memory use depends on the number of
+signals rather than the length of the trace. Scope and signal pointers stay
+valid until parse_stream returns. Every method does nothing by default.
+*/
+class VCDVisitor {
+public:
+    virtual ~VCDVisitor() {}
+    //! A $date command.
+    virtual void on_date(const std::string & date) {}
+    //! A $version command.
+    virtual void on_version(const std::string & version) {}
+    //! A $timescale command.
+    virtual void on_timescale(VCDTimeRes resolution, VCDTimeUnit units) {}
+    //! A scope was opened, including the implicit $root scope.
+    virtual void on_scope(VCDScope * scope) {}
+    //! The innermost open scope was closed.
+    virtual void on_upscope(VCDScope * scope) {}
+    //! A $var was declared. signal->handle identifies its value changes.
+    virtual void on_var(VCDSignal * signal) {}
+    //! The $enddefinitions command, file holds all declarations.
+    virtual void on_enddefinitions(VCDFile * file) {}
+    //! A #time command.
+    virtual void on_timestamp(VCDTime time) {}
+    //! The signal with the given handle changed value.
+    virtual void on_value_change(VCDSignalHandle handle, VCDTime time,
+                                 const VCDValue & value) {}
+    //! In follow mode, all data so far was reported and the parser waits.
+    virtual void on_wait() {}
+};
+
+/*!
+@brief Runs a VCDVisitor on a thread of its own, so that decoding and the
+visitor's work overlap.
+@details Used by VCDFileParser::parse_stream and seek_stream when
+pipeline_batch is set. Timestamps, value changes and waits are copied into
+batches, which pass through a lock-free single producer, single consumer
+ring of RING_SIZE batches to the consumer thread. The producer waits while
+the ring is full, so at most RING_SIZE batches are in flight. Declarations
+are passed on directly once the ring has drained, so the target sees every
+event in file order and on one thread at a time.
+*/
+class VCDPipeline : public VCDVisitor {
+public:
+    //! Batches in the ring.
+    static const unsigned RING_SIZE = 8;
+
+    //! Start the consumer thread, which passes batches of size events on.
+    VCDPipeline(VCDVisitor & target, size_t size);
+    //! Calls finish.
+    ~VCDPipeline();
+
+    void on_date(const std::string & date) {
+        drain();
+        this->target.on_date(date);
+    }
+    void on_version(const std::string & version) {
+        drain();
+        this->target.on_version(version);
+    }
+    void on_timescale(VCDTimeRes resolution, VCDTimeUnit units) {
+        drain();
+        this->target.on_timescale(resolution, units);
+    }
+    void on_scope(VCDScope * scope) {
+        drain();
+        this->target.on_scope(scope);
+    }
+    void on_upscope(VCDScope * scope) {
+        drain();
+        this->target.on_upscope(scope);
+    }
+    void on_var(VCDSignal * signal) {
+        drain();
+        this->target.on_var(signal);
+    }
+    void on_enddefinitions(VCDFile * file) {
+        drain();
+        this->target.on_enddefinitions(file);
+    }
+    void on_timestamp(VCDTime time);
+    void on_value_change(VCDSignalHandle handle, VCDTime time,
+                         const VCDValue & value);
+    //! Passed on as soon as the events before it have been.
+    void on_wait();
+
+    //! Pass everything on and stop the consumer thread.
+    void finish();
+
+private:
+    typedef enum {
+        EVENT_TIMESTAMP,
+        EVENT_VALUE,
+        EVENT_WAIT
+    } EventKind;
+
+    //! One event of a batch, value changes have their value alongside.
+    typedef struct {
+        VCDTime         time;
+        VCDSignalHandle handle;
+        EventKind       kind;
+    } Event;
+
+    typedef struct {
+        std::vector<Event>    events;
+        //! Values of the EVENT_VALUE events, by event index.
+        std::vector<VCDValue> values;
+        size_t                count;
+    } Batch;
+
+    //! Batch being filled, waiting for room in the ring first.
+    Batch & open_batch();
+    //! Hand the batch being filled to the consumer, if it has events.
+    void publish();
+    //! Publish, then wait until the consumer has passed everything on.
+    void drain();
+    //! Body of the consumer thread.
+    void run();
+
+    VCDVisitor          & target;
+    size_t                size;
+    Batch                 ring[RING_SIZE];
+    //! Batches published and batches passed on, the ring holds the
+    //! difference.
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+    //! Set by finish once the last batch is published.
+    std::atomic<bool>     done;
+    //! True while the producer has a batch open, see open_batch.
+    bool                  filling;
+    std::thread           consumer;
+};
+
+#ifndef VCD_NO_STATS
+//! Compile statement only when statistics are built in, see VCDStats.
+#define VCD_STATS(statement) statement
+#else
+#define VCD_STATS(statement)
+#endif
+
+/*!
+@brief Phase timers and activity counters of parsing, as printed by
+vcd-parse --stats.
+@details Collected while VCDFileParser::stats points at an instance. Built
+with VCD_NO_STATS defined, the collection compiles to nothing.
+*/
+class VCDStats {
+public:
+    //! Parsing phases timed separately.
+    typedef enum {
+        STATS_INPUT,        //!< Opening and mapping the file.
+        STATS_DECLARATIONS, //!< flex and bison, all of it without a mapping.
+        STATS_VALUES,       //!< Value decoding, storing or visiting included.
+        STATS_MERGE,        //!< Appending parallel ranges, within values.
+        STATS_OUTPUT,       //!< Visitor formatting, within values.
+        STATS_CACHE,        //!< Reading and writing the cache.
+        STATS_PHASES
+    } Phase;
+
+    //! Seconds spent in each phase.
+    double   seconds[STATS_PHASES];
+    //! Size of the input files.
+    uint64_t bytes;
+    //! Tokens matched by flex.
+    uint64_t tokens;
+    //! Timestamps and value changes parsed.
+    uint64_t timestamps;
+    uint64_t changes;
+    //! Value changes of each handle.
+    std::vector<uint64_t>    signal_changes;
+    //! Path of the first signal declared with each handle.
+    std::vector<std::string> signal_names;
+
+    VCDStats();
+    //! Add the size of filepath to bytes.
+    void add_input(const std::string & filepath);
+    //! Size signal_changes once the handles are known.
+    void add_handles(size_t count) {
+        if(this->signal_changes.size() < count)
+            this->signal_changes.resize(count, 0);
+    }
+    //! Count a value change reported to a visitor.
+    void add_change(VCDSignalHandle handle) {
+        this->signal_changes[handle]++;
+        this->changes++;
+    }
+    /*!
+    @brief Take the signal names of a parsed file.
+    @param stored Also count the values and timestamps stored in it.
+    */
+    void add_file(VCDFile * file, bool stored);
+    //! Print the phases, rates, peak memory and the top most active signals.
+    void print(FILE * out, unsigned top) const;
+};
+
+//! Adds the time until it goes out of scope to a phase of a VCDStats.
+class VCDStatsTimer {
+    VCDStats      * stats;
+    VCDStats::Phase phase;
+    std::chrono::steady_clock::time_point start;
+public:
+    VCDStatsTimer(VCDStats * stats, VCDStats::Phase phase) :
+        stats(stats), phase(phase) {
+        if(stats)
+            this->start = std::chrono::steady_clock::now();
+    }
+    ~VCDStatsTimer() {
+        if(this->stats) {
+            std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - this->start;
+            this->stats->seconds[this->phase] += elapsed.count();
+        }
+    }
+};
+
+//! A signal whose values differ between two traces, see VCDDiff.
+typedef struct {
+    std::string path;   //!< Path of the signal, see VCDFile::signal_path.
+    VCDTime     time;   //!< First time the values differ.
+    std::string golden; //!< Value of the golden trace then, as in a VCD.
+    std::string other;  //!< Value of the other trace then.
+} VCDDifference;
+
+/*!
+@brief Compares the value histories of two parsed traces.
+@details Signals are matched by path. At each time either trace changes a
+signal, the values in force once all changes at that time are applied are
+compared, so repeated values and changes that are undone at the same time
+do not count. Only the first difference of each signal is found, and the
+signals are compared on several threads. The histories of a compressed file
+are expanded one signal at a time and freed once it is compared.
+*/
+class VCDDiff {
+    /*!
+    @brief Find the first difference between history a of the golden trace
+    and history b of the other one.
+    @returns false if they agree from from to to.
+    */
+    bool compare(const VCDSignalValues * a, const VCDSignalValues * b,
+                 VCDDifference & difference) const;
+public:
+    VCDDiff();
+
+    //! Only differences from this time on are reported. Defaults to 0.
+    VCDTime  from;
+    //! Changes after this time are ignored. Defaults to the largest time.
+    VCDTime  to;
+    //! Threads to compare on, 0 for one per core. Defaults to 0.
+    unsigned threads;
+
+    //! Paths of the signals found in only one of the traces.
+    std::vector<std::string>   only_golden;
+    std::vector<std::string>   only_other;
+    //! Differing signals, by time and then path.
+    std::vector<VCDDifference> differences;
+    //! Number of signals found in both traces.
+    size_t                     compared;
+    //! True if the traces have different timescales.
+    bool                       timescale_differs;
+
+    //! Compare other against golden, replacing the results.
+    void compare(VCDFile * golden, VCDFile * other);
+    //! True if no difference was found.
+    bool same() const {
+        return this->only_golden.empty() && this->only_other.empty() &&
+               this->differences.empty() && !this->timescale_differs;
+    }
+    //! Print the results, limited to top differences.
+    void print(FILE * out, size_t top) const;
 };
 
 /*!
@@ -258,27 +2051,301 @@ class VCDFileParser {
     //! Utility function for stopping parsing.
     void scan_end   ();
 
+    //! State of the flex scanner, valid between scan_begin and scan_end.
+    void * scanner;
+
+    /*!
+    @brief Map filepath into memory and locate the value change section.
+    @details In follow mode this waits until the declarations are complete.
+    @returns false if the file cannot be mapped, in which case it is read
+    through stdio instead.
+    */
+    bool map_input();
+    //! Single attempt of map_input. @returns false if it cannot map yet.
+    bool try_map_input();
+    //! Release the mapping created by map_input.
+    void unmap_input();
+    /*!
+    @brief Decode a range of the value change section without going through
+    flex and bison.
+    @details Tokens are kept as pointers into the range, so no strings are
+    built while scanning.
+    */
+    void scan_values(const char * begin, const char * end);
+    /*!
+    @brief Decode a range of the value change section into range, starting
+    with time in force. Safe to run on several ranges at once.
+    */
+    void scan_range(const char * begin, const char * end, VCDTime time,
+                    VCDValueRange & range) const;
+    /*!
+    @brief Split the value change section at timestamps and decode the
+    pieces on separate threads.
+    */
+    void scan_parallel();
+    /*!
+    @brief Start decompressing filepath and read its declarations into
+    pipe_declarations.
+    @returns false if filepath is not compressed.
+    */
+    bool open_pipe();
+    //! Stop decompressing and release the pipe.
+    void close_pipe();
+    /*!
+    @brief Decode the value change section from the pipe.
+    @returns false if decompression fails.
+    */
+    bool scan_pipe();
+    /*!
+    @brief Decode the value change section, then keep decoding whatever is
+    appended to the file until stop_follow is called.
+    */
+    void scan_follow();
+    //! Record checkpoints of the value change section into index_out.
+    void scan_index();
+    //! Report the values of resume_at, then decode from its timestamp on.
+    void scan_resume();
+    /*!
+    @brief Skip to window_begin, report the values in force there, then
+    decode up to the first timestamp after window_end.
+    */
+    void scan_window();
+    //! True if window_begin or window_end are set.
+    bool windowed() const {
+        return this->window_begin != 0 ||
+               this->window_end != std::numeric_limits<VCDTime>::max();
+    }
+    /*!
+    @brief True while add_timestamp and add_value apply the window, for the
+    input scan_window cannot skip through: stdin, compressed and unmapped
+    files, and follow mode.
+    */
+    bool                  window_filter;
+    //! True once the values in force at window_begin were reported.
+    bool                  window_open;
+    //! True once a timestamp after window_end was seen.
+    bool                  window_closed;
+    //! Last value of each handle before window_begin, until window_open.
+    std::vector<VCDValue> window_values;
+    std::vector<uint8_t>  window_known;
+    /*!
+    @brief Apply the window to a timestamp, see window_filter.
+    @returns false if the timestamp is not to be reported.
+    */
+    bool window_timestamp(VCDTime time);
+    /*!
+    @brief Apply the window to a value change, keeping it as the value in
+    force at window_begin if it comes before.
+    @returns false if the change is not to be reported.
+    */
+    bool window_value(VCDSignalHandle handle, const VCDValue & value);
+    //! Report window_begin and the values kept for it.
+    void open_window();
+
+    //! Parse filepath, storing values unless a visitor is set.
+    VCDFile * parse(const std::string & filepath);
+
+    //! True for each handle with a signal that passes the path filters.
+    std::vector<bool> selected;
+    //! True if include_paths or exclude_paths are set.
+    bool filtering() const {
+        return !this->include_paths.empty() || !this->exclude_paths.empty();
+    }
+    //! Mark the handle of signal as selected if its path passes the filters.
+    void filter_signal(const VCDSignal * signal);
+
+    //! Index being built by build_index, nullptr otherwise.
+    VCDCheckpointIndex  * index_out;
+    //! Checkpoint a seek resumes from, nullptr otherwise.
+    const VCDCheckpoint * resume_at;
+
+    //! Set by stop_follow.
+    std::atomic<bool> stopped;
+
+    //! Compressed input, or nullptr.
+    VCDInputPipe * pipe;
+    //! Start of the pipe data up to the end of $enddefinitions.
+    std::string    pipe_declarations;
+    //! Data already taken from the pipe after pipe_declarations.
+    std::string    pipe_pending;
+
+    //! Start of the memory mapped input file, or nullptr.
+    const char * map_base;
+    //! Size in bytes of the mapping at map_base.
+    size_t       map_size;
+    //! First byte after the $enddefinitions command in the mapped file.
+    const char * body_begin;
+    //! One past the last byte of the mapped file.
+    const char * body_end;
+
 public:
     //! Create a new parser/
     VCDFileParser();
     ~VCDFileParser() {}
-    
+
     /*!
     @brief Parse the suppled file.
+    @details Files compressed with gzip or xz are decompressed on a
+    separate thread, see VCDInputPipe.
     @returns A handle to the parsed VCDFile object or nullptr if parsing
     fails.
     */
     VCDFile * parse_file(const std::string & filepath);
-    
+
+    /*!
+    @brief Parse the supplied file, passing its contents to visitor instead
+    of building a VCDFile.
+    @returns false if parsing fails.
+    */
+    bool parse_stream(const std::string & filepath, VCDVisitor & visitor);
+
+    /*!
+    @brief Parse several files at once, each by its own VCDFileParser with
+    the settings of this one.
+    @param jobs Number of files parsed at the same time, 0 for one per core.
+    @returns The parsed files in the order of filepaths, nullptr for each
+    one that failed to parse.
+    */
+    std::vector<VCDFile*> parse_files(
+        const std::vector<std::string> & filepaths, unsigned jobs = 0);
+
     //! The current file being parsed.
     std::string filepath;
-    
+
     //! Should we debug tokenising?
     bool trace_scanning;
 
     //! Should we debug parsing of tokens?
     bool trace_parsing;
 
+    /*!
+    @brief Memory map regular input files.
+    @details Only the declarations are tokenised by flex, the value change
+    section is decoded directly from the mapping. Defaults to true.
+    */
+    bool use_mmap;
+
+    /*!
+    @brief Number of threads parse_file uses to decode the value change
+    section of a memory mapped file.
+    @details 0 uses one thread per core. Defaults to 1. The section is split
+    at lines beginning with '#', so a $comment in it must not contain such a
+    line. parse_stream always decodes on the calling thread.
+    */
+    unsigned threads;
+
+    /*!
+    @brief Keep a binary cache next to each file parsed by parse_file.
+    @details The cache is filepath with ".cache" appended. When it is up to
+    date the file is loaded from it instead of being parsed, otherwise it
+    is rewritten after parsing. Defaults to false.
+    */
+    bool use_cache;
+
+    /*!
+    @brief Follow a file that is still being written, as tail -f does.
+    @details Once the end of the file is reached the parser waits for it to
+    grow, with inotify where available and by polling otherwise, and
+    decodes the complete lines appended to it. A partially written last
+    line is held back until its newline arrives. Parsing ends when
+    stop_follow is called or the file shrinks. Needs a memory mapped,
+    uncompressed file. Defaults to false.
+    */
+    bool follow;
+    /*!
+    @brief Extend vector values written with fewer bits than their signal
+    was declared with, as VCD defines, so that every value of a signal has
+    its declared width.
+    @details Defaults to false, values keep the width they are written
+    with. The cache is not used while extending.
+    */
+    bool extend_vectors;
+    /*!
+    @brief Only decode the value changes from window_begin to window_end.
+    @details Changes before window_begin are skipped over without being
+    decoded; the last one of each signal is decoded and reported at
+    window_begin, under a timestamp of its own, so the state there is
+    right. Reading stops at the first timestamp after window_end. Defaults
+    to the whole file. Only memory mapped, uncompressed files are skipped
+    through; other input is decoded up to window_end, keeping the last
+    value of each signal until window_begin, with the same results. The
+    cache is not used while windowing.
+    */
+    VCDTime window_begin;
+    //! Last time decoded, see window_begin.
+    VCDTime window_end;
+    /*!
+    @brief Bytes of values parse_file keeps in memory for each file, 0 for
+    no limit.
+    @details Values beyond it are spilled to a temporary file in
+    spill_directory, see VCDFile::set_memory_budget. Defaults to 0.
+    */
+    size_t memory_budget;
+    //! Directory of the spill files, $TMPDIR or /tmp if empty.
+    std::string spill_directory;
+    /*!
+    @brief Keep the values of parse_file compressed, see
+    VCDFile::set_compressed.
+    @details The cache is not used while compressing. Defaults to false.
+    */
+    bool compress_values;
+    /*!
+    @brief Events per batch handed from the decoding thread to the visitor
+    of parse_stream and seek_stream, 0 to call the visitor directly.
+    @details With a batch size the visitor runs on a thread of its own, see
+    VCDPipeline. Defaults to 0.
+    */
+    size_t pipeline_batch;
+    //! Statistics to collect into, nullptr for none. Defaults to nullptr.
+    VCDStats * stats;
+
+    //! End follow mode, may be called from any thread.
+    void stop_follow() {
+        this->stopped = true;
+    }
+
+    /*!
+    @brief Path patterns of the signals to keep, all signals if empty.
+    @details A signal path is the names of its enclosing scopes below $root
+    and its reference, joined by '/', for example "top/dut/clk". In a
+    pattern '*' matches any run of characters, '/' included, and '?' any
+    single character, and a leading '/' is ignored. Filtered out signals
+    are still declared but get no values. The cache is not used while
+    filtering.
+    */
+    std::vector<std::string> include_paths;
+    //! Path patterns of the signals to drop, applied after include_paths.
+    std::vector<std::string> exclude_paths;
+
+    //! Apply the path filters once all signals are declared.
+    void end_definitions();
+
+    /*!
+    @brief Build a checkpoint index of a memory mapped file.
+    @param interval Minimum time between checkpoints.
+    @returns The index or nullptr if the file cannot be parsed or mapped.
+    */
+    VCDCheckpointIndex * build_index(const std::string & filepath,
+                                     VCDTime interval);
+    /*!
+    @brief Parse filepath from the last checkpoint of index at or before
+    time.
+    @details The declarations are parsed in full, then the values saved in
+    the checkpoint are added at the checkpoint time and decoding resumes at
+    its timestamp. Earlier value changes are skipped.
+    @returns nullptr if parsing fails or index was not built from the file
+    as it is now.
+    */
+    VCDFile * seek_file(const std::string & filepath,
+                        const VCDCheckpointIndex & index, VCDTime time);
+    /*!
+    @brief As seek_file, passing the contents to visitor instead of
+    building a VCDFile.
+    */
+    bool seek_stream(const std::string & filepath,
+                     const VCDCheckpointIndex & index, VCDTime time,
+                     VCDVisitor & visitor);
+
     //! Reports errors to stderr.
     //void error(const VCDParser::location & l, const std::string & m);
 
@@ -287,11 +2354,74 @@ public:
 
     //! Current file being parsed and constructed.
     VCDFile * fh;
+
+    //! Receives events during parse_stream, nullptr otherwise.
+    VCDVisitor * visitor;
     
+    //! Current time while parsing the VCD file.
+    VCDTime current_time;
+
     //! Current stack of scopes being parsed.
     std::stack<VCDScope*> scopes;
+
+    //! Reused to decode vector values without allocating for each change.
+    VCDValue vector_value;
+
+    //! Add a scope to the current file and report it.
+    void add_scope(VCDScope * scope) {
+        this->fh->add_scope(scope);
+        if(this->visitor)
+            this->visitor->on_scope(scope);
+    }
+    //! Close the innermost scope and report it.
+    void upscope() {
+        VCDScope * scope = this->scopes.top();
+        this->scopes.pop();
+        if(this->visitor)
+            this->visitor->on_upscope(scope);
+    }
+    //! Add a signal to the current file and report it.
+    void add_signal(VCDSignal * signal) {
+        this->fh->add_signal(signal);
+        if(filtering())
+            filter_signal(signal);
+        if(this->visitor)
+            this->visitor->on_var(signal);
+    }
+    //! True once the input after the window can be skipped.
+    bool past_window() const {
+        return this->window_filter && this->window_closed;
+    }
+    //! Record or report a timestamp.
+    void add_timestamp(VCDTime time) {
+        if(this->window_filter && !window_timestamp(time))
+            return;
+        if(this->visitor) {
+            VCD_STATS(if(this->stats) this->stats->timestamps++;)
+            this->visitor->on_timestamp(time);
+        } else {
+            this->fh->add_timestamp(time);
+        }
+    }
+    //! Width to extend vector values of handle to, see extend_vectors.
+    VCDSignalSize vector_width(VCDSignalHandle handle) const {
+        return this->extend_vectors ? this->fh->get_handle_size(handle) : 0;
+    }
+    //! Record or report a value change.
+    void add_value(VCDSignalHandle handle, VCDTime time,
+                   const VCDValue & value) {
+        if(this->window_filter && !window_value(handle, value))
+            return;
+        if(this->visitor) {
+            VCD_STATS(if(this->stats) this->stats->add_change(handle);)
+            this->visitor->on_value_change(handle, time, value);
+        } else {
+            this->fh->add_signal_value(handle, time, value);
+        }
+    }
 };
 
 #define YY_DECL \
-    VCDParser::parser::symbol_type yylex (VCDFileParser & driver)
+    VCDParser::parser::symbol_type yylex (VCDFileParser & driver, \
+                                          void * yyscanner)
 #endif
@@ -0,0 +1,265 @@
+/*!
+@file
+@brief Definition of the packed VCDBitVector storage.
+*/
+
+#include <cstring>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "VCDTypes.hpp"
+
+//! Reverse the order of the bits of x.
+static inline uint64_t reverse_bits(uint64_t x) {
+    x = __builtin_bswap64(x);
+    x = (x & 0x0f0f0f0f0f0f0f0fULL) << 4 | ((x >> 4) & 0x0f0f0f0f0f0f0f0fULL);
+    x = (x & 0x3333333333333333ULL) << 2 | ((x >> 2) & 0x3333333333333333ULL);
+    x = (x & 0x5555555555555555ULL) << 1 | ((x >> 1) & 0x5555555555555555ULL);
+    return x;
+}
+
+/*!
+@brief Plane bits of the n value characters at text, the last one in bit 0.
+@details Characters other than 0, 1 and z/Z read as X.
+*/
+static void decode_chars(const char * text, size_t n, uint64_t & val,
+                         uint64_t & xz) {
+    val = 0;
+    xz  = 0;
+    for(size_t i = 0; i < n; i++) {
+        char c = text[i];
+        val = val << 1 | (c == '1' || (c | 0x20) == 'z');
+        xz  = xz << 1 | (c != '0' && c != '1');
+    }
+}
+
+#if !defined(__SSE2__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+//! The high bit of each byte of x that equals c.
+static inline uint64_t bytes_equal(uint64_t x, uint8_t c) {
+    uint64_t t    = x ^ (0x0101010101010101ULL * c);
+    uint64_t low7 = 0x7f7f7f7f7f7f7f7fULL;
+    return ~(((t & low7) + low7) | t) & 0x8080808080808080ULL;
+}
+
+//! Gather the high bit of byte i of m into bit i.
+static inline uint64_t gather_bytes(uint64_t m) {
+    return ((m >> 7) * 0x0102040810204080ULL) >> 56;
+}
+#endif
+
+/*!
+@brief Plane words of the 64 value characters at text, as decode_chars.
+@details Each character is compared against '0', '1' and 'z' with case
+folded, giving masks with bit i set for text[i], which are then put in
+plane order, text[63] being the least significant bit.
+*/
+static inline void decode_word(const char * text, uint64_t & val,
+                               uint64_t & xz) {
+    uint64_t zeros = 0, ones = 0, zs = 0;
+#if defined(__AVX2__)
+    const __m256i zero  = _mm256_set1_epi8('0');
+    const __m256i one   = _mm256_set1_epi8('1');
+    const __m256i z     = _mm256_set1_epi8('z');
+    const __m256i lower = _mm256_set1_epi8(0x20);
+    for(unsigned i = 0; i < 64; i += 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i *)(text + i));
+        zeros |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                     _mm256_cmpeq_epi8(c, zero)) << i;
+        ones  |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                     _mm256_cmpeq_epi8(c, one)) << i;
+        zs    |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                     _mm256_cmpeq_epi8(_mm256_or_si256(c, lower), z)) << i;
+    }
+#elif defined(__SSE2__)
+    const __m128i zero  = _mm_set1_epi8('0');
+    const __m128i one   = _mm_set1_epi8('1');
+    const __m128i z     = _mm_set1_epi8('z');
+    const __m128i lower = _mm_set1_epi8(0x20);
+    for(unsigned i = 0; i < 64; i += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(text + i));
+        zeros |= (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, zero)) << i;
+        ones  |= (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, one)) << i;
+        zs    |= (uint64_t)_mm_movemask_epi8(
+                     _mm_cmpeq_epi8(_mm_or_si128(c, lower), z)) << i;
+    }
+#elif __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for(unsigned i = 0; i < 64; i += 8) {
+        uint64_t c;
+        std::memcpy(&c, text + i, sizeof(c));
+        zeros |= gather_bytes(bytes_equal(c, '0')) << i;
+        ones  |= gather_bytes(bytes_equal(c, '1')) << i;
+        zs    |= gather_bytes(bytes_equal(c | 0x2020202020202020ULL,
+                                          'z')) << i;
+    }
+#else
+    decode_chars(text, 64, val, xz);
+    return;
+#endif
+    val = reverse_bits(ones | zs);
+    xz  = reverse_bits(~(zeros | ones));
+}
+
+void VCDBitVector::allocate(VCDSignalSize width) {
+    if(is_heap() && !this->external && width > 64 &&
+       (width + 63) / 64 == words()) {
+        // Same number of words, reuse the block.
+        this->width = width;
+        this->known = true;
+        std::memset(this->store.heap, 0, 2 * words() * sizeof(uint64_t));
+        return;
+    }
+    release();
+    this->width = width;
+    this->known = true;
+    if(is_heap()) {
+        this->store.heap = new uint64_t[2 * words()]();
+    } else {
+        this->store.local[0] = 0;
+        this->store.local[1] = 0;
+    }
+}
+
+VCDBitVector::VCDBitVector(const VCDBitVector & other) :
+    width(0), external(false), known(true) {
+    *this = other;
+}
+
+VCDBitVector & VCDBitVector::operator=(const VCDBitVector & other) {
+    if(this == &other)
+        return *this;
+    if(other.width != this->width || this->external)
+        allocate(other.width);
+    std::memcpy(planes(), other.planes(), 2 * words() * sizeof(uint64_t));
+    this->known = other.known;
+    return *this;
+}
+
+VCDBitVector & VCDBitVector::operator=(VCDBitVector && other) {
+    if(this == &other)
+        return *this;
+    if(other.external) {
+        // Arena storage cannot change hands.
+        return *this = (const VCDBitVector &)other;
+    }
+    release();
+    this->width = other.width;
+    this->store = other.store;
+    this->known = other.known;
+    other.width = 0;
+    return *this;
+}
+
+void VCDBitVector::place(const VCDBitVector & other, VCDArena & arena) {
+    release();
+    this->width = other.width;
+    this->known = other.known;
+    if(is_heap()) {
+        size_t bytes = 2 * words() * sizeof(uint64_t);
+        char * block = (char *)arena.allocate(bytes);
+        std::memcpy(block, other.planes(), bytes);
+        this->external     = true;
+        this->store.offset = block - (char *)this;
+    } else {
+        this->store = other.store;
+    }
+}
+
+void VCDBitVector::assign(const char * text, size_t length,
+                          VCDSignalSize width) {
+    if(width < length)
+        width = length;
+    if(width != this->width || this->external)
+        allocate(width);
+    uint64_t * val     = value_words();
+    uint64_t * xz      = xz_words();
+    uint64_t   unknown = 0;
+    // Whole words from the rightmost character, which is bit 0.
+    const char * p = text + length;
+    unsigned     w = 0;
+    for(; p - text >= 64; w++) {
+        p -= 64;
+        decode_word(p, val[w], xz[w]);
+        unknown |= xz[w];
+    }
+    if(w < words()) {
+        // The leftmost character extends the value: X and Z themselves,
+        // 0 and 1 with 0.
+        uint64_t lead_val = 0, lead_xz = 0;
+        if(length)
+            decode_chars(text, 1, lead_val, lead_xz);
+        uint64_t ext_xz  = 0 - lead_xz;
+        uint64_t ext_val = ext_xz & (0 - lead_val);
+        size_t   left    = p - text;
+        for(; w < words(); w++, left = 0) {
+            uint64_t v = ext_val, x = ext_xz;
+            if(left) {
+                decode_chars(text, left, v, x);
+                v |= ext_val << left;
+                x |= ext_xz << left;
+            }
+            if(w == words() - 1 && width % 64) {
+                uint64_t used = ((uint64_t)1 << (width % 64)) - 1;
+                v &= used;
+                x &= used;
+            }
+            val[w]   = v;
+            xz[w]    = x;
+            unknown |= x;
+        }
+    }
+    this->known = !unknown;
+}
+
+bool VCDBitVector::is_known() const {
+    if(this->known)
+        return true;
+    const uint64_t * xz = xz_words();
+    for(unsigned w = 0; w < words(); w++)
+        if(xz[w])
+            return false;
+    return true;
+}
+
+bool VCDBitVector::operator==(const VCDBitVector & other) const {
+    if(this->width != other.width)
+        return false;
+    size_t bytes = words() * sizeof(uint64_t);
+    return std::memcmp(value_words(), other.value_words(), bytes) == 0 &&
+           std::memcmp(xz_words(), other.xz_words(), bytes) == 0;
+}
+
+std::string VCDBitVector::to_string() const {
+    static const char chars[] = {'0', '1', 'X', 'Z'};
+    std::string out(this->width, '0');
+    for(VCDSignalSize i = 0; i < this->width; i++)
+        out[this->width - 1 - i] = chars[get_bit(i)];
+    return out;
+}
+
+std::string VCDBitVector::to_hex() const {
+    static const char digits[] = "0123456789abcdef";
+    unsigned ndigits = (this->width + 3) / 4;
+    std::string out(ndigits, '0');
+    const uint64_t * val = value_words();
+    const uint64_t * xz  = xz_words();
+    for(unsigned d = 0; d < ndigits; d++) {
+        unsigned shift = (d % 16) * 4;
+        unsigned mask  = 0xf;
+        if(d == ndigits - 1 && this->width % 4)
+            mask = (1u << (this->width % 4)) - 1;
+        unsigned v = (val[d / 16] >> shift) & mask;
+        unsigned x = (xz[d / 16] >> shift) & mask;
+        char c;
+        if(!x)
+            c = digits[v];
+        else if(x == mask && v == mask)
+            c = 'z';
+        else
+            c = 'x';
+        out[ndigits - 1 - d] = c;
+    }
+    return out;
+}
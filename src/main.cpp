@@ -3,35 +3,229 @@
 @brief Definition of the VCDFileParser class
 */
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <list>
+#include <thread>
 #include "VCDTypes.hpp"
 #include "VCDParser.hpp"
 
 #define DOLLAR "$"
 
 static bool traceAll;//=true;
-VCDFileParser::VCDFileParser() {
+VCDFileParser::VCDFileParser() : vector_value(VCDBitVector()) {
     this->trace_scanning = traceAll;
     this->trace_parsing  = traceAll;
+    this->use_mmap       = true;
+    this->map_base       = nullptr;
+    this->map_size       = 0;
+    this->body_begin     = nullptr;
+    this->body_end       = nullptr;
+    this->visitor        = nullptr;
+    this->threads        = 1;
+    this->use_cache      = false;
+    this->scanner        = nullptr;
+    this->current_time   = 0;
+    this->index_out      = nullptr;
+    this->resume_at      = nullptr;
+    this->pipe           = nullptr;
+    this->follow         = false;
+    this->extend_vectors = false;
+    this->window_begin   = 0;
+    this->window_end     = std::numeric_limits<VCDTime>::max();
+    this->window_filter  = false;
+    this->window_open    = false;
+    this->window_closed  = false;
+    this->memory_budget  = 0;
+    this->pipeline_batch = 0;
+    this->compress_values = false;
+    this->stopped        = false;
+    this->stats          = nullptr;
 }
 
 VCDFile * VCDFileParser::parse_file(const std::string &filepath) {
+    this->visitor = nullptr;
+    bool cache = this->use_cache && !filtering() && !this->extend_vectors && !windowed() && !this->compress_values && !filepath.empty() && filepath != "-";
+    std::string cachepath = filepath + ".cache";
+    if (cache) {
+        VCD_STATS(VCDStatsTimer timer(this->stats, VCDStats::STATS_CACHE);)
+        VCDFile * cached = new VCDFile();
+        if (cached->read_cache(cachepath, filepath)) {
+            VCD_STATS(if (this->stats) this->stats->add_file(cached, true);)
+            return cached;
+        }
+        delete cached;
+    }
+    VCDFile * tr = parse(filepath);
+    if (tr && cache) {
+        VCD_STATS(VCDStatsTimer timer(this->stats, VCDStats::STATS_CACHE);)
+        tr->write_cache(cachepath, filepath);
+    }
+    return tr;
+}
+
+bool VCDFileParser::parse_stream(const std::string &filepath, VCDVisitor & visitor) {
+    VCDPipeline * pipeline = this->pipeline_batch ? new VCDPipeline(visitor, this->pipeline_batch) : nullptr;
+    this->visitor = pipeline ? pipeline : &visitor;
+    VCDFile * declarations = parse(filepath);
+    // The visitor may still be working on the last batches, which point at
+    // the declarations.
+    delete pipeline;
+    this->visitor = nullptr;
+    if (declarations == nullptr)
+        return false;
+    delete declarations;
+    return true;
+}
+
+VCDCheckpointIndex * VCDFileParser::build_index(const std::string &filepath, VCDTime interval) {
+    this->visitor = nullptr;
+    VCDCheckpointIndex * index = new VCDCheckpointIndex();
+    index->interval = interval;
+    this->index_out = index;
+    VCDFile * tr = parse(filepath);
+    this->index_out = nullptr;
+    // Without a mapping there are no offsets to resume from.
+    if (tr == nullptr || index->handle_count != tr->get_handle_count() || !index->source_size) {
+        delete tr;
+        delete index;
+        return nullptr;
+    }
+    delete tr;
+    return index;
+}
+
+VCDFile * VCDFileParser::seek_file(const std::string &filepath, const VCDCheckpointIndex & index, VCDTime time) {
+    if (!index.matches(filepath))
+        return nullptr;
+    this->visitor = nullptr;
+    this->resume_at = index.find(time);
+    VCDFile * tr = parse(filepath);
+    this->resume_at = nullptr;
+    return tr;
+}
+
+bool VCDFileParser::seek_stream(const std::string &filepath, const VCDCheckpointIndex & index, VCDTime time, VCDVisitor & visitor) {
+    if (!index.matches(filepath))
+        return false;
+    VCDPipeline * pipeline = this->pipeline_batch ? new VCDPipeline(visitor, this->pipeline_batch) : nullptr;
+    this->visitor = pipeline ? pipeline : &visitor;
+    this->resume_at = index.find(time);
+    VCDFile * declarations = parse(filepath);
+    this->resume_at = nullptr;
+    delete pipeline;
+    this->visitor = nullptr;
+    if (declarations == nullptr)
+        return false;
+    delete declarations;
+    return true;
+}
+
+std::vector<VCDFile*> VCDFileParser::parse_files(
+    const std::vector<std::string> & filepaths, unsigned jobs) {
+    std::vector<VCDFile*> files(filepaths.size(), nullptr);
+    if (jobs == 0)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    if (jobs > filepaths.size())
+        jobs = filepaths.size();
+    // Each worker takes the next file that nobody has started yet.
+    std::atomic<size_t> next(0);
+    auto work = [&](void) -> void {
+        VCDFileParser parser;
+        parser.trace_scanning = this->trace_scanning;
+        parser.trace_parsing  = this->trace_parsing;
+        parser.use_mmap       = this->use_mmap;
+        parser.threads        = this->threads;
+        parser.use_cache      = this->use_cache;
+        parser.extend_vectors = this->extend_vectors;
+        parser.window_begin   = this->window_begin;
+        parser.window_end     = this->window_end;
+        parser.memory_budget  = this->memory_budget;
+        parser.spill_directory = this->spill_directory;
+        parser.compress_values = this->compress_values;
+        parser.include_paths  = this->include_paths;
+        parser.exclude_paths  = this->exclude_paths;
+        for (size_t i = next++; i < filepaths.size(); i = next++)
+            files[i] = parser.parse_file(filepaths[i]);
+    };
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < jobs; i++)
+        workers.push_back(std::thread(work));
+    for (std::thread & worker : workers)
+        worker.join();
+    return files;
+}
+
+VCDFile * VCDFileParser::parse(const std::string &filepath) {
     this->filepath = filepath;
-    scan_begin();
+    this->current_time = 0;
+    this->stopped = false;
+    this->selected.clear();
+    {
+        VCD_STATS(VCDStatsTimer timer(this->stats, VCDStats::STATS_INPUT);)
+        scan_begin();
+    }
+    // scan_window skips through mapped files, anything else is windowed as
+    // its events are reported.
+    this->window_filter = windowed() && !this->index_out && !this->resume_at && (this->pipe || !this->body_begin || this->follow);
+    this->window_open = this->window_begin == 0;
+    this->window_closed = false;
     this->fh = new VCDFile();
     VCDFile * tr = this->fh;
+    if (this->memory_budget && !this->visitor && !this->fh->set_memory_budget(this->memory_budget, this->spill_directory))
+        error("Cannot create a spill file, keeping all values in memory");
+    if (this->compress_values && !this->visitor)
+        this->fh->set_compressed();
     this->fh->root_scope = new VCDScope;
     this->fh->root_scope->name = std::string("$root");
     this->fh->root_scope->type = VCD_SCOPE_ROOT;
     this->scopes.push(this->fh->root_scope);
-    tr->add_scope(scopes.top());
-    VCDParser::parser parser(*this);
+    add_scope(scopes.top());
+    VCDParser::parser parser(*this, this->scanner);
     parser.set_debug_level(trace_parsing);
-    int result = parser.parse();
+    int result;
+    {
+        VCD_STATS(VCDStatsTimer timer(this->stats, VCDStats::STATS_DECLARATIONS);)
+        result = parser.parse();
+    }
+    if (result == 0) {
+        VCD_STATS(VCDStatsTimer timer(this->stats, VCDStats::STATS_VALUES);)
+        if (this->pipe) {
+            if (!scan_pipe()) {
+                error("Cannot decompress " + filepath);
+                result = 1;
+            }
+        } else if (this->body_begin) {
+            if (this->index_out)
+                scan_index();
+            else if (this->resume_at)
+                scan_resume();
+            else if (this->follow)
+                scan_follow();
+            else if (windowed())
+                scan_window();
+            else if (this->visitor)
+                scan_values(this->body_begin, this->body_end);
+            else
+                scan_parallel();
+        }
+        // The values in force at window_begin are reported even if the
+        // file ends before it, as scan_window does.
+        if (this->window_filter && !this->window_open)
+            open_window();
+        if (this->compress_values && !this->visitor)
+            this->fh->shrink_histories();
+    }
+    this->window_filter = false;
+    this->window_values.clear();
+    this->window_known.clear();
     scopes.pop();
     scan_end();
     if (result == 0 ) {
+        VCD_STATS(if (this->stats) { this->stats->add_input(filepath); this->stats->add_file(tr, !this->visitor); })
         this->fh = nullptr;
         return tr;
     } else {
@@ -41,6 +235,31 @@ VCDFile * VCDFileParser::parse_file(const std::string &filepath) {
     }
 }
 
+static bool match_any(const std::vector<std::string> & patterns, const std::string & path) {
+    // Paths have no leading '/', so one in a pattern is skipped.
+    for (const std::string & pattern : patterns)
+        if (VCDPathIndex::match(pattern.c_str() + std::min(pattern.find_first_not_of('/'), pattern.length()), path.c_str()))
+            return true;
+    return false;
+}
+
+void VCDFileParser::filter_signal(const VCDSignal * signal) {
+    std::string path = VCDFile::signal_path(signal);
+    if (this->selected.size() <= signal->handle)
+        this->selected.resize(signal->handle + 1, false);
+    if ((this->include_paths.empty() || match_any(this->include_paths, path))
+     && !match_any(this->exclude_paths, path))
+        this->selected[signal->handle] = true;
+}
+
+void VCDFileParser::end_definitions() {
+    VCD_STATS(if (this->stats) this->stats->add_handles(this->fh->get_handle_count());)
+    if (!filtering())
+        return;
+    this->selected.resize(this->fh->get_handle_count(), false);
+    this->fh->select_handles(this->selected);
+}
+
 void vcderror(const VCDParser::location & l, const std::string & m){
     std::cerr << "line "<< l.begin.line << std::endl;
     std::cerr << " : "<<m<<std::endl;
@@ -56,17 +275,33 @@ bool filterENARDY=true;
 typedef struct {
     std::list<std::string> name;
 } MapNameItem;
-std::map<std::string, MapNameItem *> mapName;
-std::map<std::string, bool> actionMethod;
 
-std::map<VCDScope *, std::string> scopeName;
-std::map<std::string, std::string> mapValue;
 typedef struct {
     std::string value;
     bool seen;
+    bool present;   // Has been given a value, so it is listed as a parameter.
 } CurrentValueType;
-std::map<std::string, CurrentValueType> currentValue;
-std::map<std::string, std::string> currentCycle;
+
+typedef enum {
+    SIGNAL_RDY,     // Method ready, printed when it rises.
+    SIGNAL_ENA,     // Method enable, printed when it rises.
+    SIGNAL_PLAIN,   // Printed with its value whenever it changes.
+    SIGNAL_PARAM    // Parameter of an action method, printed with the call.
+} SignalKind;
+
+typedef struct {
+    std::string name;
+    SignalKind kind;
+    std::string label;  // Output for the signal, up to its value if it has one.
+} SignalDesc;
+
+typedef struct {
+    uint32_t ena;           // Signal id of the __ENA signal.
+    uint32_t rdy;           // Signal id of the matching __RDY signal.
+    std::string name;       // Base name of the method.
+    uint32_t paramBegin;    // Signal ids named name$..., which are sorted
+    uint32_t paramEnd;      // so they form the range [paramBegin,paramEnd).
+} MethodDesc;
 
 static bool inline endswith(std::string str, std::string suffix)
 {
@@ -172,7 +407,150 @@ static char VCDBit2Char(VCDBit b) {
     }
 }
 
-void VCDFile::add_scope( VCDScope * s)
+//! Both hex digits of each byte value, high digit first.
+static struct HexPairs {
+    char pair[256][2];
+    HexPairs() {
+        for (int i = 0; i < 256; i++) {
+            pair[i][0] = "0123456789abcdef"[i >> 4];
+            pair[i][1] = "0123456789abcdef"[i & 0xf];
+        }
+    }
+} hexPairs;
+
+/*!
+@brief Collects output in a large buffer that is written out in big blocks,
+instead of going through printf for every field.
+*/
+class OutputBuffer {
+    FILE * out;
+    std::vector<char> data;
+    size_t used;
+public:
+    static const size_t BUFFER_SIZE = 1 << 20;
+
+    OutputBuffer(FILE * out) : out(out), data(BUFFER_SIZE), used(0) {}
+    ~OutputBuffer() {
+        flush();
+    }
+    //! Room for count more bytes at the returned pointer.
+    char * reserve(size_t count) {
+        if (used + count > data.size()) {
+            flush();
+            if (count > data.size())
+                data.resize(count);
+        }
+        return data.data() + used;
+    }
+    void append(const char * text, size_t length) {
+        memcpy(reserve(length), text, length);
+        used += length;
+    }
+    void append(const std::string & text) {
+        append(text.data(), text.length());
+    }
+    void append(char c) {
+        *reserve(1) = c;
+        used++;
+    }
+    //! Same as printf("%*s", width, text).
+    void right(const std::string & text, size_t width) {
+        size_t pad = text.length() < width ? width - text.length() : 0;
+        memset(reserve(pad), ' ', pad);
+        used += pad;
+        append(text);
+    }
+    void number(uint64_t value) {
+        used += snprintf(reserve(24), 24, "%llu", (unsigned long long)value);
+    }
+    //! Write out everything appended so far.
+    void flush() {
+        if (used)
+            fwrite(data.data(), 1, used, out);
+        used = 0;
+    }
+};
+
+/*!
+@brief Prints the method calls made in each cycle of a trace, reconstructed
+from the __ENA and __RDY handshake signals of each method.
+@details Signal names are only known as strings, so at $enddefinitions they
+are sorted and given integer ids, and each __ENA signal is resolved into a
+MethodDesc. Per cycle the printer then only visits the signals that changed
+and the methods whose enable is up.
+*/
+class TransactionPrinter : public VCDVisitor {
+    //! Full names of each signal, indexed by handle.
+    std::vector<MapNameItem *> mapName;
+    //! Base names of the methods that have an __ENA signal.
+    std::map<std::string, bool> actionMethod;
+    //! Full name of each scope.
+    std::map<VCDScope *, std::string> scopeName;
+    //! __RDY signals that start out as "1".
+    std::set<std::string> rdyInit;
+    //! True once the tables below have been built.
+    bool compiled;
+
+    //! Every name that can be printed, in sorted order. Indexed by signal id.
+    std::vector<SignalDesc> signals;
+    //! Signal ids updated by each handle.
+    std::vector<std::vector<uint32_t>> handleSignals;
+    //! Method of each __ENA signal id.
+    std::vector<int32_t> methodOf;
+    //! All methods, in the order of their __ENA names.
+    std::vector<MethodDesc> methods;
+    //! Latest value of each signal id.
+    std::vector<CurrentValueType> currentValue;
+    //! Value of each signal id that changed in the current cycle, "" if it
+    //! did not or has been printed as part of a method call.
+    std::vector<std::string> currentCycle;
+    //! Signal ids with an entry in currentCycle.
+    std::vector<uint32_t> dirty;
+    //! True for the signal ids in dirty.
+    std::vector<bool> isDirty;
+    //! Methods whose enable has been raised and not yet printed.
+    std::set<uint32_t> armed;
+    //! Time of the cycle being collected.
+    VCDTime lasttime;
+    //! Everything printed, on its way to stdout.
+    OutputBuffer out;
+    //! Formatted value of the current change.
+    std::string val;
+    //! Hex digits of the current change, before '_' are inserted.
+    std::vector<char> hexDigits;
+
+    //! Build the signal and method tables from the declarations.
+    void compile();
+    //! Print the cycle at lasttime.
+    void flush();
+    //! Format a vector that has no X or Z bits into val.
+    void formatHex(const VCDBitVector & vector);
+public:
+    //! Collects the time spent printing when set.
+    VCDStats * stats;
+
+    TransactionPrinter() : compiled(false), lasttime(0), out(stdout), stats(nullptr) {}
+    ~TransactionPrinter() {
+        for (auto item : mapName)
+            delete item;
+    }
+    void on_scope(VCDScope * scope);
+    void on_var(VCDSignal * signal);
+    void on_enddefinitions(VCDFile * file) {
+        compile();
+    }
+    void on_wait() {
+        finish();
+    }
+    //! Write out all buffered output.
+    void finish() {
+        out.flush();
+        fflush(stdout);
+    }
+    void on_value_change(VCDSignalHandle handle, VCDTime time, const VCDValue & value);
+};
+
+void TransactionPrinter::on_scope( VCDScope * s)
 {
     std::string parent, name = s->name;
     if (s->parent)
@@ -185,179 +563,361 @@ void VCDFile::add_scope( VCDScope * s)
         parent = "";
     scopeName[s] = parent + name;
 //printf("[%s:%d] scope %p parent %p/%s type %d name %s\n", __FUNCTION__, __LINE__, s, s->parent, parent.c_str(), s->type, s->name.c_str());
-    this -> scopes.push_back(s);
 }
 
-void VCDFile::add_signal( VCDSignal * s)
+void TransactionPrinter::on_var( VCDSignal * s)
 {
-    this -> signals.push_back(s);
     if (s->type != VCD_VAR_WIRE)
-        printf("[%s:%d] hash %s ref %s scope %p size %x type %d\n", __FUNCTION__, __LINE__, s->hash.c_str(), s->reference.c_str(), s->scope, s->size, s->type);
+        printf("[add_signal:%d] hash %s ref %s scope %p size %x type %d\n", __LINE__, s->hash.c_str(), s->reference.c_str(), s->scope, s->size, s->type);
     std::string parent;
     if (s->scope)
         parent = scopeName[s->scope] + "/";
     parent += s->reference;    // combine parent and node names
-    if (mapName.find(s->hash) == mapName.end())
-        mapName[s->hash] = new MapNameItem({{}});
-    mapName[s->hash]->name.push_back(parent);
-    // Add a timestream entry
-    if(val_map.find(s -> hash) == val_map.end()) {
-        // Values will be populated later.
-        val_map[s -> hash] = new VCDSignalValues();
-    }
+    if (s->handle >= mapName.size())
+        mapName.resize(s->handle + 1);
+    if (!mapName[s->handle])
+        mapName[s->handle] = new MapNameItem({{}});
+    mapName[s->handle]->name.push_back(parent);
     if (isEnaName(parent) || isRdyName(parent)) {
-        currentValue[getRdyName(parent)] = {"1", false};
+        rdyInit.insert(getRdyName(parent));
     }
 }
 
-void VCDFile::add_signal_value( VCDTimedValue * time_val, VCDSignalHash   hash)
+void TransactionPrinter::compile()
 {
-    static bool first = true;
-    std::string val;
-    static int lasttime = 0;
-    int timeval = time_val->time;
-
-    if (first) {
-        first = false;
-        for (auto &itemi : mapName) {
-            for (auto namei = itemi.second->name.begin(), namee = itemi.second->name.end(); namei != namee;) {
-                int slash = namei->rfind("/");
-                int dollar = namei->find(DOLLAR);
-                if (dollar > 0 && (slash == -1 || dollar < slash) && itemi.second->name.size() != 1) {
-                    namei = itemi.second->name.erase(namei);
-                    continue;
-                }
-                if (isEnaName(*namei))
-                    actionMethod[baseMethodName(*namei)] = true;
-                namei++;
+    compiled = true;
+    for (auto itemi : mapName) {
+        for (auto namei = itemi->name.begin(), namee = itemi->name.end(); namei != namee;) {
+            int slash = namei->rfind("/");
+            int dollar = namei->find(DOLLAR);
+            if (dollar > 0 && (slash == -1 || dollar < slash) && itemi->name.size() != 1) {
+                namei = itemi->name.erase(namei);
+                continue;
             }
+            if (isEnaName(*namei))
+                actionMethod[baseMethodName(*namei)] = true;
+            namei++;
         }
     }
-    switch (time_val->value->get_type()) {
+
+    // Collect every name that can get a value, including the __RDY of each
+    // __ENA which is looked up even if it is never declared.
+    std::vector<std::string> names(rdyInit.begin(), rdyInit.end());
+    for (auto itemi : mapName)
+        for (auto name : itemi->name)
+            names.push_back(name);
+    for (size_t i = 0, count = names.size(); i < count; i++)
+        if (isEnaName(names[i]))
+            names.push_back(getRdyName(names[i]));
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    auto signalId = [&](const std::string & name) -> uint32_t {
+        return std::lower_bound(names.begin(), names.end(), name) - names.begin();
+    };
+
+    signals.resize(names.size());
+    methodOf.assign(names.size(), -1);
+    currentValue.assign(names.size(), {"", false, false});
+    currentCycle.assign(names.size(), "");
+    isDirty.assign(names.size(), false);
+    for (uint32_t id = 0; id < names.size(); id++) {
+        std::string & name = names[id];
+        SignalDesc & desc = signals[id];
+        desc.name = name;
+        if (isRdyName(name))
+            desc.kind = SIGNAL_RDY;
+        else if (isEnaName(name)) {
+            desc.kind = SIGNAL_ENA;
+            MethodDesc method;
+            method.ena = id;
+            method.rdy = signalId(getRdyName(name));
+            method.name = baseMethodName(name);
+            std::string prefix = method.name + DOLLAR;
+            method.paramBegin = signalId(prefix);
+            method.paramEnd = method.paramBegin;
+            while (method.paramEnd < names.size() && startswith(names[method.paramEnd], prefix))
+                method.paramEnd++;
+            methodOf[id] = methods.size();
+            methods.push_back(method);
+        }
+        else {
+            int ind = name.rfind(DOLLAR);
+            if (ind == -1 || !actionMethod.count(name.substr(0, ind)))
+                desc.kind = SIGNAL_PLAIN;
+            else
+                desc.kind = SIGNAL_PARAM;
+        }
+    }
+    for (auto name : rdyInit)
+        currentValue[signalId(name)] = {"1", false, true};
+    for (SignalDesc & desc : signals) {
+        // Padding of the name for a "%50s" column.
+        std::string pad(std::max<int>(0, 50 - desc.name.length()), ' ');
+        switch (desc.kind) {
+        case SIGNAL_RDY:    // only printed when the value is "1"
+            desc.label = std::string(52, ' ') + desc.name;
+            if (!pad.empty())
+                desc.label += pad + "1";
+            desc.label += "\n";
+            break;
+        case SIGNAL_ENA:    // likewise
+            desc.label = "1 " + pad + desc.name + "\n";
+            break;
+        case SIGNAL_PLAIN:
+            desc.label = "  " + pad + desc.name + " = ";
+            break;
+        case SIGNAL_PARAM:
+            break;
+        }
+    }
+
+    handleSignals.resize(mapName.size());
+    for (size_t handle = 0; handle < mapName.size(); handle++)
+        for (auto item : mapName[handle]->name) {   // maintain 'current value of signal'
+             if (item == "/CLK" || item == "/CLK_derivedClock" || item == "/CLK_sys_clk")
+                 break;
+             handleSignals[handle].push_back(signalId(item));
+        }
+}
+
+void TransactionPrinter::flush()
+{
+    VCD_STATS(VCDStatsTimer timer(stats, VCDStats::STATS_OUTPUT);)
+    static const char headerBegin[] = "--------------------------------------------------- ";
+    static const char headerEnd[] = " ----------------------\n";
+    bool found = false;
+    auto header = [&](void) -> void {
+        if (!found) {
+            out.append(headerBegin, sizeof(headerBegin) - 1);
+            out.number(lasttime);
+            out.append(headerEnd, sizeof(headerEnd) - 1);
+        }
+        found = true;
+    };
+    for (auto methodi = armed.begin(); methodi != armed.end();) {
+        MethodDesc & method = methods[*methodi];
+        CurrentValueType & rdy = currentValue[method.rdy];
+        rdy.present = true;
+        if (rdy.value != "1") {
+            methodi++;
+            continue;
+        }
+        currentValue[method.ena].seen = false;
+        currentCycle[method.ena] = "";
+        currentCycle[method.rdy] = "";
+        bool first = true;
+        header();
+        out.append(method.name);
+        out.append('(');
+        for (uint32_t param = method.paramBegin; param < method.paramEnd; param++)
+            if (currentValue[param].present) {
+                const std::string & name = signals[param].name;
+                size_t skip = method.name.length() + 1;
+                currentCycle[param] = "";
+                if (!first)
+                    out.append(", ", 2);
+                out.append(name.data() + skip, name.length() - skip);
+                out.append('=');
+                out.append(currentValue[param].value);
+                first = false;
+            }
+        out.append(") -----------\n", 14);
+        methodi = armed.erase(methodi);
+    }
+    std::sort(dirty.begin(), dirty.end());
+    for (auto id: dirty) {
+        const std::string & value = currentCycle[id];
+        if (value == "")
+            continue;
+        switch (signals[id].kind) {
+        case SIGNAL_RDY:
+            if (lasttime > 0 && value == "1") {
+                header();
+                out.append(signals[id].label);
+            }
+            break;
+        case SIGNAL_ENA:
+            if (value == "1") {
+                header();
+                out.append(signals[id].label);
+            }
+            break;
+        case SIGNAL_PLAIN:
+            header();
+            out.append(signals[id].label);
+            out.right(value, 8);
+            out.append('\n');
+            break;
+        case SIGNAL_PARAM:
+            break;
+        }
+    }
+    for (auto id: dirty) {
+        currentCycle[id] = "";
+        isDirty[id] = false;
+    }
+    dirty.clear();
+}
+
+/*!
+@brief Hex digits of a vector, as the printer has always shown them.
+@details The bits are padded on the left with width % 4 zeros and each
+complete group of four becomes a digit, so for a width of 4n+1 or 4n+3 the
+lowest two bits are not shown. A '_' is put in front of each 32 padded bits
+after the first. The digits are looked up a byte at a time, 64 bits of value
+plane per step.
+*/
+void TransactionPrinter::formatHex(const VCDBitVector & vector)
+{
+    size_t width = vector.size(), words = vector.words();
+    size_t total = width + width % 4;
+    size_t shift = total % 4;
+    size_t ndigits = total / 4;
+    const uint64_t * bits = vector.value_words();
+    if (hexDigits.size() < ndigits)
+        hexDigits.resize(ndigits);
+    char * digits = hexDigits.data();
+    // Digit d counts from the right and starts at bit shift + 4 * d.
+    for (size_t d = 0; d < ndigits; d += 16) {
+        size_t start = shift + 4 * d, w = start / 64, offset = start % 64;
+        uint64_t word = bits[w] >> offset;
+        if (offset && w + 1 < words)
+            word |= bits[w + 1] << (64 - offset);
+        for (size_t b = 0; b < 8 && d + 2 * b < ndigits; b++, word >>= 8) {
+            const char * pair = hexPairs.pair[word & 0xff];
+            size_t low = ndigits - 1 - (d + 2 * b);
+            digits[low] = pair[1];
+            if (low)
+                digits[low - 1] = pair[0];
+        }
+    }
+    val.assign(ndigits + (total ? (total - 1) / 32 : 0), '_');
+    for (size_t k = 0, pos = 0; k < ndigits; k += 8, pos += 9)
+        memcpy(&val[pos], digits + k, std::min<size_t>(8, ndigits - k));
+}
+
+void TransactionPrinter::on_value_change( VCDSignalHandle handle, VCDTime time, const VCDValue & value)
+{
+    VCDTime timeval = time;
+
+    if (!compiled)
+        compile();
+    switch (value.get_type()) {
     case VCD_SCALAR:
-        val = VCDBit2Char(time_val->value->get_value_bit());
+        val.assign(1, VCDBit2Char(value.get_value_bit()));
         break;
     case VCD_VECTOR:
-        for (auto item: *time_val->value->get_value_vector())
-            val += VCDBit2Char(item);
-        if (val.find("X") == std::string::npos && val.find("Z") == std::string::npos) {
-            int len = val.length() / 4;
-            int addLen = val.length() - len * 4;
-            std::string temp = std::string("00000000").substr(0, addLen) + val;
-            val = "";
-            unsigned i = 0;
-            int data = 0;
-            while (i < temp.length()) {
-                if (i && (i % 32) == 0)
-                    val += "_";
-                data = (data << 1) + (temp[i] - '0');
-                i++;
-                if ((i % 4) == 0) {
-                    val += "0123456789abcdef"[data];
-                    data = 0;
-                }
-            }
-        }
+        if (value.get_value_vector()->is_known())
+            formatHex(*value.get_value_vector());
+        else
+            val = value.get_value_vector()->to_string();
         break;
     case VCD_REAL:
         val = "REAL";
         break;
     default:
-printf("[%s:%d]ERRRRROROR\n", __FUNCTION__, __LINE__);
+        val = "";
+        out.flush();
+printf("[add_signal_value:%d]ERRRRROROR\n", __LINE__);
     }
-//printf("[%s:%d] timeval %x type %d: ", __FUNCTION__, __LINE__, timeval, time_val->value->get_type());
+//printf("[%s:%d] timeval %x type %d: ", __FUNCTION__, __LINE__, timeval, value.get_type());
 //printf(" VAL %s\n", val.c_str());
     if (timeval != 0 || (val.find_first_not_of("0") != std::string::npos
                       && val.find_first_not_of("_") != std::string::npos)) {
         if (lasttime != timeval) {
-            bool found = false;
-            auto header = [&](void) -> void {
-                if (!found)
-                    printf("--------------------------------------------------- %d ----------------------\n", lasttime);
-                found = true;
-            };
-            for (auto item: currentValue) {
-                 std::string rdyName = getRdyName(item.first);
-                 if (isEnaName(item.first) && item.second.value == "1" && item.second.seen && currentValue[rdyName].value == "1") {
-                     currentValue[item.first].seen = false;
-                     currentCycle[item.first] = "";
-                     currentCycle[rdyName] = "";
-                     std::string methodName = baseMethodName(item.first);
-                     std::string sep;
-                     header();
-                     printf("%s(", methodName.c_str());
-                     methodName += "$";
-                     for (auto param: currentValue)
-                          if (startswith(param.first, methodName)) {
-                              currentCycle[param.first] = "";
-                              printf("%s%s=%s", sep.c_str(), param.first.substr(methodName.length()).c_str(), param.second.value.c_str());
-                              sep = ", ";
-                          }
-                     printf(") -----------\n");
-                 }
-            }
-            for (auto item: currentCycle) {
-                std::string name = item.first, value = item.second;
-                if (value != "") {
-                    if (isRdyName(item.first)) {
-                        if (lasttime > 0 && value == "1") {
-                            int len = 50 - name.length();
-                            if (len > 0 && value == "1")
-                                 name += std::string("                                                                             ").substr(0, len) + value;
-                            header();
-                            printf(" %50s %s", " ", name.c_str());
-                            if (value.length() > 1)
-                                printf(" = %8s", value.c_str());
-                            printf("\n");
-                        }
-                    }
-                    else if (isEnaName(item.first)) {
-                        if (value == "1") {
-                        std::string prefix = " ";
-                        if (value == "1")
-                            prefix = value;
-                        header();
-                        printf("%s %50s", prefix.c_str(), name.c_str());
-                        if (value.length() > 1)
-                            printf(" = %8s", value.c_str());
-                        printf("\n");
-//std::string rname = getRdyName(item.first);
-//printf("[%s:%d] RDY %s = %s\n", __FUNCTION__, __LINE__, rname.c_str(), currentValue[rname].c_str());
-                        }
-                    }
-                    else {
-                        int ind = name.rfind(DOLLAR);
-                        if (ind == -1 || !actionMethod[name.substr(0, ind)]) {
-                            header();
-                            printf("  %50s = %8s\n", name.c_str(), value.c_str());
-                        }
-                    }
-                }
-            }
-            currentCycle.clear();
+            flush();
             lasttime = timeval;
         }
-        std::string sep;
-        auto nameList = mapName[hash];
-        for (auto item: nameList->name) {   // maintain 'current value of signal'
-             if (item == "/CLK" || item == "/CLK_derivedClock" || item == "/CLK_sys_clk")
-                 break;
-             currentValue[item] = {val, true};
-             currentCycle[item] = val;
+        for (auto id: handleSignals[handle]) {
+            CurrentValueType & current = currentValue[id];
+            current.value = val;
+            current.seen = true;
+            current.present = true;
+            if (methodOf[id] >= 0) {
+                if (val == "1")
+                    armed.insert(methodOf[id]);
+                else
+                    armed.erase(methodOf[id]);
+            }
+            if (!isDirty[id]) {
+                isDirty[id] = true;
+                dirty.push_back(id);
+            }
+            currentCycle[id] = val;
         }
     }
-    this -> val_map[hash] -> push_back(time_val);
 }
 
 /*!
 @brief Standalone test function to allow testing of the VCD file parser.
 */
 int main (int argc, char** argv){
-    std::string infile (argv[1]);
-    std::cout << "Parsing " << infile << std::endl;
     VCDFileParser parser;
-    VCDFile * trace = parser.parse_file(infile);
+    VCDStats stats;
+    VCDDiff diff;
+    bool compare = false;
+    bool print_stats = false;
+    int argi = 1;
+    for (; argi < argc - 1; argi++) {
+        std::string option(argv[argi]);
+        if (option == "-f")             // follow a growing dump
+            parser.follow = true;
+        else if (option == "--stats")   // phase timings and signal activity on stderr
+            print_stats = true;
+        else if (option == "--pipeline")    // print on a thread of its own
+            parser.pipeline_batch = 4096;
+        else if (option.compare(0, 11, "--pipeline=") == 0)   // ... handing over this many changes at a time
+            parser.pipeline_batch = strtoull(option.c_str() + 11, nullptr, 10);
+        else if (option == "--diff")    // compare GOLDEN NEW instead of printing
+            compare = true;
+        else if (option.compare(0, 7, "--from=") == 0)    // only parse and compare from this time
+            parser.window_begin = diff.from = strtoull(option.c_str() + 7, nullptr, 10);
+        else if (option.compare(0, 5, "--to=") == 0)
+            parser.window_end = diff.to = strtoull(option.c_str() + 5, nullptr, 10);
+        else if (option.compare(0, 9, "--memory=") == 0)  // MB of values --diff keeps in memory per file
+            parser.memory_budget = (size_t)strtoull(option.c_str() + 9, nullptr, 10) << 20;
+        else
+            break;
+    }
+    std::string infile (argv[argi]);
+    if (compare) {
+        if (argc - argi != 2) {
+            fprintf(stderr, "usage: %s [--from=T] [--to=T] [--memory=MB] --diff GOLDEN NEW\n", argv[0]);
+            return 2;
+        }
+        std::string golden = infile;
+        infile = argv[argi + 1];
+        // Both dumps are parsed at the same time, each on all cores, with
+        // values extended so that differently written equal values match.
+        parser.threads = 0;
+        parser.extend_vectors = true;
+        std::vector<VCDFile*> traces = parser.parse_files({golden, infile}, 2);
+        if (!traces[0] || !traces[1]) {
+            fprintf(stderr, "could not parse %s\n", (traces[0] ? infile : golden).c_str());
+            delete traces[0];
+            delete traces[1];
+            return 2;
+        }
+        diff.compare(traces[0], traces[1]);
+        diff.print(stdout, 100);
+        delete traces[0];
+        delete traces[1];
+        return diff.same() ? 0 : 1;
+    }
+    std::cout << "Parsing " << infile << std::endl;
+    TransactionPrinter printer;
+    if (print_stats) {
+        parser.stats = &stats;
+        printer.stats = &stats;
+    }
+    parser.parse_stream(infile, printer);
+    printer.finish();
+    if (print_stats) {
+        fflush(stdout);
+        stats.print(stderr, 20);
+    }
 printf("\n[%s:%d]DONE\n", __FUNCTION__, __LINE__); return 0;
+    VCDFile * trace = parser.parse_file(infile);
     std::cout << "Parse successful." << std::endl;
     std::cout << "Version:       " << trace->version << std::endl;
     std::cout << "Date:          " << trace->date << std::endl;
@@ -0,0 +1,843 @@
+/*!
+@file
+@brief Checks the parser and the formats it keeps traces in against plain
+reference models.
+@details Run by make check, on a VCD file generated from a seeded random
+number generator:
+- unmapped: a file read without memory mapping, through the grammar, gives
+  the same values as the mapped decoder.
+- threads: a file decoded on several threads gives the same values as one
+  decoded on one.
+- compressed: gzip and xz copies of the file give the same values as the
+  file itself.
+- filter: include_paths and exclude_paths keep the values of the signals
+  they select, decoded mapped and unmapped, and drop all others, and
+  find_matching ignores a leading '/'.
+- seek: seek_file from every checkpoint of an index, built or written and
+  read back, against the full parse from that time on, and an index that
+  is cut short is refused and leaves the one read into unchanged.
+- window: window_begin and window_end, mapped, unmapped and gzip
+  compressed, against the full parse cut to the window.
+- history: VCDHistory push_back, iteration, value_at, lower_bound, expand
+  and append against a list of the changes with repeats dropped, on values
+  made up directly rather than parsed.
+- query: VCDQuery value_at, values_at, count_values and find_edges on every
+  signal, parsed plain and compressed, against linear scans of its values.
+- cache: write_cache then read_cache gives back the same declarations,
+  timestamps and values, and a cache that is cut short or out of date is
+  refused.
+
+Failures are printed, up to a few in all, and the exit status is 1 if there
+were any.
+
+Usage: vcd-check [--seed=N]
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <lzma.h>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include <zlib.h>
+
+#include "VCDTypes.hpp"
+
+//! Changes of one signal in time order, as a reference model keeps them.
+typedef std::vector<std::pair<VCDTime, VCDValue>> Changes;
+
+//! Timestamps and the changes of each handle of a parsed file.
+typedef struct {
+    std::vector<VCDTime> times;
+    std::vector<Changes> values;
+} Trace;
+
+static std::mt19937_64 rng;
+static unsigned        failures = 0;
+
+//! Count a failure of what if ok is false, printing the first few.
+static bool check(bool ok, const std::string & what) {
+    if(!ok && failures++ < 20)
+        std::printf("FAIL %s\n", what.c_str());
+    return ok;
+}
+
+//! A number from 0 to n - 1.
+static uint64_t random_below(uint64_t n) {
+    return rng() % n;
+}
+
+//! True if a and b hold the same value, compared bit by bit.
+static bool same_value(const VCDValue & a, const VCDValue & b) {
+    if(a.get_type() != b.get_type())
+        return false;
+    if(a.get_type() == VCD_SCALAR)
+        return a.get_value_bit() == b.get_value_bit();
+    if(a.get_type() == VCD_REAL)
+        return a.get_value_real() == b.get_value_real();
+    const VCDBitVector * va = a.get_value_vector();
+    const VCDBitVector * vb = b.get_value_vector();
+    if(va->size() != vb->size())
+        return false;
+    for(VCDSignalSize i = 0; i < va->size(); i++)
+        if(va->get_bit(i) != vb->get_bit(i))
+            return false;
+    return true;
+}
+
+//! Copy the timestamps and values out of file.
+static Trace trace_of(VCDFile * file) {
+    Trace trace;
+    for(VCDTime time : *file->get_timestamps())
+        trace.times.push_back(time);
+    trace.values.resize(file->get_handle_count());
+    for(size_t h = 0; h < file->get_handle_count(); h++)
+        for(VCDTimedValue tv : *file->get_signal_values(h))
+            trace.values[h].push_back(std::make_pair(tv.time, *tv.value));
+    return trace;
+}
+
+//! True if a and b hold the same timestamps and values.
+static bool same_trace(const Trace & a, const Trace & b) {
+    if(a.times != b.times || a.values.size() != b.values.size())
+        return false;
+    for(size_t h = 0; h < a.values.size(); h++) {
+        if(a.values[h].size() != b.values[h].size())
+            return false;
+        for(size_t i = 0; i < a.values[h].size(); i++)
+            if(a.values[h][i].first != b.values[h][i].first ||
+               !same_value(a.values[h][i].second, b.values[h][i].second))
+                return false;
+    }
+    return true;
+}
+
+//! True if a and b declare the same scopes and signals.
+static bool same_declarations(VCDFile * a, VCDFile * b) {
+    if(a->get_handle_count() != b->get_handle_count() ||
+       a->get_scopes()->size() != b->get_scopes()->size() ||
+       a->get_signals()->size() != b->get_signals()->size())
+        return false;
+    for(size_t i = 0; i < a->get_scopes()->size(); i++)
+        if((*a->get_scopes())[i]->name != (*b->get_scopes())[i]->name)
+            return false;
+    for(size_t i = 0; i < a->get_signals()->size(); i++) {
+        const VCDSignal * sa = (*a->get_signals())[i];
+        const VCDSignal * sb = (*b->get_signals())[i];
+        if(sa->hash != sb->hash || sa->handle != sb->handle ||
+           sa->reference != sb->reference || sa->size != sb->size ||
+           sa->type != sb->type || sa->scope->name != sb->scope->name)
+            return false;
+    }
+    return true;
+}
+
+/*!
+@brief Write a random VCD file of steps timestamps to path.
+@details A clock, a scalar, 8, 16 and 100 bit vectors and a real, with X
+and Z bits, repeated values and some signals changing twice at a
+timestamp.
+*/
+static bool write_vcd(const std::string & path, size_t steps) {
+    FILE * out = std::fopen(path.c_str(), "w");
+    if(!out)
+        return false;
+    std::fprintf(out,
+        "$timescale 1ns $end\n"
+        "$scope module top $end\n"
+        "$var wire 1 ! clk $end\n"
+        "$var wire 1 \" s $end\n"
+        "$scope module sub $end\n"
+        "$var wire 8 # v8 $end\n"
+        "$var wire 16 $ v16 $end\n"
+        "$upscope $end\n"
+        "$var wire 100 %% w $end\n"
+        "$var real 64 & r $end\n"
+        "$upscope $end\n"
+        "$enddefinitions $end\n");
+    static const char bits[] = "01xz";
+    std::vector<std::string> last(6);
+    uint64_t time = 0;
+    for(size_t step = 0; step < steps; step++) {
+        std::fprintf(out, "#%llu\n", (unsigned long long)time);
+        std::fprintf(out, "%d!\n", (int)(step & 1));
+        for(int id = 1; id < 6; id++) {
+            for(int twice = random_below(16) ? 1 : 2; twice; twice--) {
+                if(step && random_below(3))
+                    continue;
+                // Some values repeat the last one.
+                if(step && !random_below(4)) {
+                    std::fprintf(out, "%s\n", last[id].c_str());
+                    continue;
+                }
+                std::string text;
+                if(id == 1) {
+                    text += bits[random_below(4)];
+                } else if(id == 5) {
+                    char real[32];
+                    std::snprintf(real, sizeof(real), "r%.2f ",
+                                  ((int)random_below(256) - 128) / 4.0);
+                    text = real;
+                } else {
+                    unsigned width = id == 2 ? 8 : id == 3 ? 16 : 100;
+                    text = "b";
+                    for(unsigned b = 0; b < width; b++)
+                        text += bits[random_below(random_below(8) ? 2 : 4)];
+                    text += " ";
+                }
+                text += (char)('!' + id);
+                last[id] = text;
+                std::fprintf(out, "%s\n", text.c_str());
+            }
+        }
+        time += 1 + random_below(20);
+    }
+    return std::fclose(out) == 0;
+}
+
+//! Copy the first size bytes of from to to.
+static bool copy_prefix(const std::string & from, const std::string & to,
+                        long size) {
+    FILE * in  = std::fopen(from.c_str(), "rb");
+    FILE * out = std::fopen(to.c_str(), "wb");
+    bool   ok  = in && out;
+    std::vector<char> buffer(size);
+    if(ok)
+        ok = std::fread(buffer.data(), 1, size, in) == (size_t)size &&
+             std::fwrite(buffer.data(), 1, size, out) == (size_t)size;
+    if(in)
+        std::fclose(in);
+    if(out && std::fclose(out) != 0)
+        ok = false;
+    return ok;
+}
+
+//! Round trip vcdpath through a cache file.
+static void check_cache(const std::string & vcdpath) {
+    std::string cachepath = vcdpath + ".cache";
+    std::string shortpath = vcdpath + ".short";
+    VCDFileParser parser;
+    VCDFile * file = parser.parse_file(vcdpath);
+    if(check(file && file->write_cache(cachepath, vcdpath),
+             "cache: write_cache")) {
+        VCDFile cached;
+        if(check(cached.read_cache(cachepath, vcdpath), "cache: read_cache"))
+            check(same_declarations(file, &cached) &&
+                  same_trace(trace_of(file), trace_of(&cached)),
+                  "cache: same contents");
+
+        // A cache cut short anywhere is refused.
+        FILE * in = std::fopen(cachepath.c_str(), "rb");
+        long size = 0;
+        if(in && std::fseek(in, 0, SEEK_END) == 0)
+            size = std::ftell(in);
+        if(in)
+            std::fclose(in);
+        bool refused = size > 0;
+        for(int i = 0; i < 20 && refused; i++) {
+            VCDFile cut;
+            refused = copy_prefix(cachepath, shortpath,
+                                  random_below(size)) &&
+                      !cut.read_cache(shortpath, vcdpath);
+        }
+        check(refused, "cache: short cache refused");
+
+        // So is one older than its source.
+        FILE * out = std::fopen(vcdpath.c_str(), "a");
+        if(out) {
+            std::fputs("#999999999\n", out);
+            std::fclose(out);
+        }
+        VCDFile stale;
+        check(out && !stale.read_cache(cachepath, vcdpath),
+              "cache: stale cache refused");
+    }
+    delete file;
+    unlink(cachepath.c_str());
+    unlink(shortpath.c_str());
+}
+
+//! Position of the last change at or before time, -1 if there is none.
+static ptrdiff_t find_change(const Changes & changes, VCDTime time) {
+    size_t lo = 0, hi = changes.size();
+    while(lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if(changes[mid].first <= time)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (ptrdiff_t)lo - 1;
+}
+
+//! Least significant bit of a scalar or vector value.
+static VCDBit lsb(const VCDValue & value) {
+    if(value.get_type() == VCD_SCALAR)
+        return value.get_value_bit();
+    return value.get_value_vector()->get_bit(0);
+}
+
+//! True if going from prev to value is an edge, as VCDQuery documents it.
+static bool reference_edge(VCDEdge edge, const VCDValue & prev,
+                           const VCDValue & value) {
+    if(edge == VCD_EDGE_ANY)
+        return !same_value(prev, value);
+    if(prev.get_type() == VCD_REAL || value.get_type() == VCD_REAL) {
+        if(prev.get_type() != value.get_type())
+            return false;
+        if(edge == VCD_EDGE_RISING)
+            return value.get_value_real() > prev.get_value_real();
+        return value.get_value_real() < prev.get_value_real();
+    }
+    VCDBit p = lsb(prev), c = lsb(value);
+    bool   p_xz = p == VCD_X || p == VCD_Z;
+    if(edge == VCD_EDGE_RISING)
+        return (p == VCD_0 && c != VCD_0) || (p_xz && c == VCD_1);
+    return (p == VCD_1 && c != VCD_1) || (p_xz && c == VCD_0);
+}
+
+//! Compare the queries of query on handle with linear scans of changes.
+static void check_queries(const std::string & what, const VCDQuery & query,
+                          VCDSignalHandle handle, const Changes & changes,
+                          VCDTime end) {
+    static const VCDEdge edges[] = {
+        VCD_EDGE_RISING, VCD_EDGE_FALLING, VCD_EDGE_ANY
+    };
+    static const VCDTime max = std::numeric_limits<VCDTime>::max();
+    bool value_at_ok = true, count_ok = true, edges_ok = true;
+    for(int i = 0; i < 60; i++) {
+        VCDTime t0 = i == 0 ? 0 : random_below(end + 2);
+        VCDTime t1 = i == 0 ? max : i == 1 ? t0 - 1 :
+                     t0 + random_below(end / 4 + 2);
+        VCDValue      storage(VCD_X);
+        VCDTimedValue tv = query.value_at(handle, t0, storage);
+        ptrdiff_t     at = find_change(changes, t0);
+        if((tv.value != nullptr) != (at >= 0) ||
+           (tv.value && (!same_value(*tv.value, changes[at].second) ||
+                         tv.time != changes[at].first)))
+            value_at_ok = false;
+
+        size_t count = 0;
+        for(const auto & change : changes)
+            count += change.first >= t0 && change.first <= t1;
+        if(query.count_values(handle, t0, t1) != count)
+            count_ok = false;
+
+        for(VCDEdge edge : edges) {
+            std::vector<VCDTime> expected, found;
+            VCDValue prev(VCD_X);
+            for(const auto & change : changes) {
+                if(change.first >= t0 && change.first <= t1 &&
+                   reference_edge(edge, prev, change.second))
+                    expected.push_back(change.first);
+                prev = change.second;
+            }
+            size_t n = query.find_edges(handle, edge, t0, t1, &found);
+            if(n != expected.size() || found != expected)
+                edges_ok = false;
+        }
+    }
+    check(value_at_ok, what + ": value_at");
+    check(count_ok, what + ": count_values");
+    check(edges_ok, what + ": find_edges");
+}
+
+/*!
+@brief Compare values_at over all handles of query with the last change of
+each at or before a few times.
+*/
+static void check_values_at(const std::string & what, const VCDQuery & query,
+                            const std::vector<Changes> & values, VCDTime end) {
+    std::vector<VCDSignalHandle> handles;
+    for(size_t h = 0; h < values.size(); h++)
+        handles.push_back(h);
+    bool ok = true;
+    for(int i = 0; i < 20; i++) {
+        VCDTime time = random_below(end + 2);
+        std::vector<VCDTimedValue> found;
+        std::vector<VCDValue>      storage;
+        query.values_at(handles, time, found, storage);
+        for(size_t h = 0; h < values.size(); h++) {
+            ptrdiff_t at = find_change(values[h], time);
+            if((found[h].value != nullptr) != (at >= 0) ||
+               (found[h].value &&
+                (!same_value(*found[h].value, values[h][at].second) ||
+                 found[h].time != values[h][at].first)))
+                ok = false;
+        }
+    }
+    check(ok, what + ": values_at");
+}
+
+/*!
+@brief Check the queries on every signal of vcdpath, parsed plain and
+compressed.
+@details A compressed file drops repeated values, its queries are checked
+against the changes without them.
+*/
+static void check_query(const std::string & vcdpath) {
+    VCDFileParser plain_parser, compressed_parser;
+    compressed_parser.compress_values = true;
+    VCDFile * plain      = plain_parser.parse_file(vcdpath);
+    VCDFile * compressed = compressed_parser.parse_file(vcdpath);
+    if(check(plain && compressed, "query: parse")) {
+        VCDQuery plain_query(plain, 2), compressed_query(compressed, 2);
+        Trace    trace = trace_of(plain);
+        VCDTime  end   = trace.times.back();
+        std::vector<Changes> distinct(trace.values.size());
+        for(size_t h = 0; h < trace.values.size(); h++) {
+            for(const auto & change : trace.values[h])
+                if(distinct[h].empty() ||
+                   !same_value(distinct[h].back().second, change.second))
+                    distinct[h].push_back(change);
+            std::string what = "query handle " + std::to_string(h);
+            check_queries(what + " plain", plain_query, h, trace.values[h],
+                          end);
+            check_queries(what + " compressed", compressed_query, h,
+                          distinct[h], end);
+        }
+        check_values_at("query plain", plain_query, trace.values, end);
+        check_values_at("query compressed", compressed_query, distinct, end);
+    }
+    delete plain;
+    delete compressed;
+}
+
+//! A width bit vector, with X and Z bits unless known.
+static VCDValue random_vector(unsigned width, bool known) {
+    static const char bits[] = "01xz";
+    std::string text(width, '0');
+    for(char & c : text)
+        c = bits[random_below(known || random_below(4) ? 2 : 4)];
+    return VCDValue(VCDBitVector(text.data(), text.size()));
+}
+
+/*!
+@brief Make count values of one kind, some repeated from a small pool and
+some repeating the previous value.
+@param kind 's' for scalars, 'v' for vectors of width bits and 'r' for
+reals.
+*/
+static std::vector<VCDValue> random_values(char kind, unsigned width,
+                                           size_t count) {
+    std::vector<VCDValue> pool, values;
+    for(size_t i = 0; i < 16 + count; i++) {
+        if(kind == 's')
+            pool.push_back(VCDValue((VCDBit)random_below(4)));
+        else if(kind == 'v')
+            pool.push_back(random_vector(width, random_below(2)));
+        else
+            pool.push_back(VCDValue((VCDReal)(int64_t)(rng() >> 20) / 8));
+    }
+    for(size_t i = 0; i < count; i++) {
+        uint64_t pick = random_below(8);
+        if(pick == 0 && !values.empty())
+            values.push_back(values.back());
+        else if(pick < 3)
+            values.push_back(pool[random_below(16)]);
+        else
+            values.push_back(pool[16 + i]);
+    }
+    return values;
+}
+
+//! The next time after time: mostly small steps, some repeats, some leaps.
+static VCDTime next_time(VCDTime time) {
+    uint64_t pick = random_below(16);
+    if(pick == 0)
+        return time;
+    if(pick == 1)
+        return time + random_below((uint64_t)1 << 40);
+    return time + 1 + random_below(300);
+}
+
+//! Number of changes before the first one not before time.
+static size_t changes_before(const Changes & changes, VCDTime time) {
+    return time ? find_change(changes, time - 1) + 1 : 0;
+}
+
+//! True if history holds exactly changes.
+static bool same_history(const VCDHistory & history, const Changes & changes) {
+    if(history.size() != changes.size())
+        return false;
+    size_t i = 0;
+    for(VCDHistory::const_iterator it = history.begin(); it != history.end();
+        ++it, i++) {
+        VCDTimedValue tv = *it;
+        if(tv.time != changes[i].first ||
+           !same_value(*tv.value, changes[i].second))
+            return false;
+    }
+    return i == changes.size();
+}
+
+//! Push values into a history and compare it with the reference model.
+static void check_history(const char * name,
+                          const std::vector<VCDValue> & values) {
+    VCDHistory           history;
+    Changes              changes;
+    std::vector<VCDTime> times;
+    VCDTime              time = random_below(3);
+    for(const VCDValue & value : values) {
+        history.push_back(time, value);
+        if(changes.empty() || !same_value(changes.back().second, value))
+            changes.push_back(std::make_pair(time, value));
+        times.push_back(time);
+        time = next_time(time);
+    }
+    std::string what = std::string("history ") + name;
+    check(same_history(history, changes), what + ": iteration");
+
+    // value_at and lower_bound around every change and at random times.
+    std::vector<VCDTime> probes = {0, std::numeric_limits<VCDTime>::max()};
+    for(const auto & change : changes) {
+        probes.push_back(change.first);
+        probes.push_back(change.first + 1);
+        if(change.first)
+            probes.push_back(change.first - 1);
+    }
+    for(int i = 0; i < 100; i++)
+        probes.push_back(random_below(time + 10));
+    bool value_at_ok = true, lower_bound_ok = true;
+    for(VCDTime probe : probes) {
+        VCDValue  value(VCD_X);
+        VCDTime   since = 0;
+        ptrdiff_t at    = find_change(changes, probe);
+        bool      found = history.value_at(probe, value, &since);
+        if(found != (at >= 0) ||
+           (found && (!same_value(value, changes[at].second) ||
+                      since != changes[at].first)))
+            value_at_ok = false;
+        size_t position = changes_before(changes, probe);
+        VCDHistory::const_iterator it = history.lower_bound(probe);
+        if(it.position() != position ||
+           (position < changes.size() &&
+            (*it).time != changes[position].first))
+            lower_bound_ok = false;
+    }
+    check(value_at_ok, what + ": value_at");
+    check(lower_bound_ok, what + ": lower_bound");
+
+    VCDArena        arena;
+    VCDSignalValues expanded;
+    history.expand(expanded, arena);
+    bool expand_ok = expanded.size() == changes.size();
+    size_t i = 0;
+    for(auto it = expanded.begin(); expand_ok && it != expanded.end();
+        ++it, i++)
+        expand_ok = it->time == changes[i].first &&
+                    same_value(*it->value, changes[i].second);
+    check(expand_ok, what + ": expand");
+
+    // Split the changes in two, append the second half to the first.
+    size_t     split = random_below(values.size() + 1);
+    VCDHistory head, tail;
+    for(size_t j = 0; j < values.size(); j++)
+        (j < split ? head : tail).push_back(times[j], values[j]);
+    head.append(tail);
+    check(same_history(head, changes), what + ": append");
+}
+
+//! Check histories of each kind of value, the file is not used.
+static void check_histories(const std::string &) {
+    check_history("scalar", random_values('s', 1, 5000));
+    check_history("vector", random_values('v', 16, 5000));
+    check_history("wide", random_values('v', 200, 2000));
+    check_history("real", random_values('r', 64, 3000));
+}
+
+//! Parse vcdpath in full, memory mapped and on one thread.
+static Trace plain_trace(const std::string & vcdpath) {
+    VCDFileParser parser;
+    VCDFile * file = parser.parse_file(vcdpath);
+    Trace     trace;
+    if(check(file != nullptr, "plain parse"))
+        trace = trace_of(file);
+    delete file;
+    return trace;
+}
+
+//! Compare a parsed file with expected, then delete it.
+static void check_file(const std::string & what, VCDFile * file,
+                       const Trace & expected) {
+    if(check(file != nullptr, what + ": parse"))
+        check(same_trace(trace_of(file), expected), what + ": same values");
+    delete file;
+}
+
+//! Parse path with parser and compare the result with expected.
+static void check_parse(const std::string & what, VCDFileParser & parser,
+                        const std::string & path, const Trace & expected) {
+    check_file(what, parser.parse_file(path), expected);
+}
+
+//! The grammar decodes an unmapped file as the mapped decoder does.
+static void check_unmapped(const std::string & vcdpath) {
+    Trace         expected = plain_trace(vcdpath);
+    VCDFileParser parser;
+    parser.use_mmap = false;
+    check_parse("unmapped", parser, vcdpath, expected);
+}
+
+/*!
+@brief Decoding on several threads gives the values of decoding on one.
+@details Ranges under a megabyte are decoded on one thread, so this writes
+a file of its own that is big enough to be split.
+*/
+static void check_threads(const std::string & vcdpath) {
+    std::string bigpath = vcdpath + ".threads";
+    if(check(write_vcd(bigpath, 60000), "threads: write " + bigpath)) {
+        Trace expected = plain_trace(bigpath);
+        for(unsigned threads : {2u, 3u, 8u, 0u}) {
+            VCDFileParser parser;
+            parser.threads = threads;
+            check_parse("threads " + std::to_string(threads), parser,
+                        bigpath, expected);
+        }
+    }
+    unlink(bigpath.c_str());
+}
+
+//! Write a gzip or, if xz is true, an xz compressed copy of from to to.
+static bool compress_copy(const std::string & from, const std::string & to,
+                          bool xz) {
+    std::string data;
+    FILE * in = std::fopen(from.c_str(), "rb");
+    if(!in)
+        return false;
+    char   buffer[1 << 16];
+    size_t got;
+    while((got = std::fread(buffer, 1, sizeof(buffer), in)) > 0)
+        data.append(buffer, got);
+    std::fclose(in);
+    if(!xz) {
+        gzFile out = gzopen(to.c_str(), "wb");
+        if(!out)
+            return false;
+        bool ok = gzwrite(out, data.data(), data.size()) == (int)data.size();
+        return gzclose(out) == Z_OK && ok;
+    }
+    std::vector<uint8_t> packed(lzma_stream_buffer_bound(data.size()));
+    size_t used = 0;
+    if(lzma_easy_buffer_encode(6, LZMA_CHECK_CRC64, nullptr,
+                               (const uint8_t *)data.data(), data.size(),
+                               packed.data(), &used,
+                               packed.size()) != LZMA_OK)
+        return false;
+    FILE * out = std::fopen(to.c_str(), "wb");
+    bool   ok  = out && std::fwrite(packed.data(), 1, used, out) == used;
+    if(out && std::fclose(out) != 0)
+        ok = false;
+    return ok;
+}
+
+//! Compressed copies decode to the values of the file itself.
+static void check_compressed(const std::string & vcdpath) {
+    Trace expected = plain_trace(vcdpath);
+    for(bool xz : {false, true}) {
+        std::string what = xz ? "xz" : "gzip";
+        std::string path = vcdpath + (xz ? ".xz" : ".gz");
+        if(check(compress_copy(vcdpath, path, xz), what + ": compress")) {
+            VCDFileParser parser;
+            check_parse(what, parser, path, expected);
+        }
+        unlink(path.c_str());
+    }
+}
+
+/*!
+@brief Filtered parses keep the values of the signals selected and only
+those.
+@details Keeps sub/v8, by a pattern that also matches v16, which is then
+excluded, and r by its full path written with a leading '/'.
+*/
+static void check_filter(const std::string & vcdpath) {
+    Trace         full = plain_trace(vcdpath);
+    VCDFileParser plain;
+    VCDFile *     file = plain.parse_file(vcdpath);
+    if(!check(file != nullptr, "filter: parse"))
+        return;
+    // A leading '/' makes no difference to a pattern.
+    std::vector<VCDSignal*> found, rooted;
+    file->get_paths().find_matching("top/sub/v*", found);
+    file->get_paths().find_matching("/top/sub/v*", rooted);
+    check(found.size() == 2 && rooted == found, "filter: find_matching");
+
+    Trace expected = full;
+    for(VCDSignal * signal : *file->get_signals())
+        if(signal->reference != "v8" && signal->reference != "r")
+            expected.values[signal->handle].clear();
+    delete file;
+    for(bool mapped : {true, false}) {
+        VCDFileParser parser;
+        parser.use_mmap = mapped;
+        parser.include_paths.push_back("top/sub/*");
+        parser.include_paths.push_back("/top/r");
+        parser.exclude_paths.push_back("*16");
+        check_parse(mapped ? "filter" : "filter unmapped", parser, vcdpath,
+                    expected);
+    }
+}
+
+/*!
+@brief The part of full from begin to end, as a parse that starts at begin
+gives it.
+@details begin is a timestamp of its own holding the last value of each
+signal before it, followed by the timestamps and changes in [begin, end].
+*/
+static Trace trace_between(const Trace & full, VCDTime begin, VCDTime end) {
+    Trace part;
+    part.times.push_back(begin);
+    for(VCDTime time : full.times)
+        if(time > begin && time <= end)
+            part.times.push_back(time);
+    part.values.resize(full.values.size());
+    for(size_t h = 0; h < full.values.size(); h++) {
+        const Changes & changes = full.values[h];
+        size_t i = changes_before(changes, begin);
+        if(i > 0)
+            part.values[h].push_back(std::make_pair(begin,
+                                                    changes[i - 1].second));
+        for(; i < changes.size() && changes[i].first <= end; i++)
+            part.values[h].push_back(changes[i]);
+    }
+    return part;
+}
+
+//! Seek through index to each of its checkpoints and some times between.
+static void check_seeks(const std::string & what, const std::string & vcdpath,
+                        const VCDCheckpointIndex & index, const Trace & full) {
+    const VCDTime end = std::numeric_limits<VCDTime>::max();
+    std::vector<VCDTime> times;
+    for(const VCDCheckpoint & cp : index.checkpoints) {
+        times.push_back(cp.time);
+        times.push_back(cp.time + random_below(index.interval));
+    }
+    for(VCDTime time : times) {
+        const VCDCheckpoint * cp = index.find(time);
+        VCDFileParser parser;
+        check_file(what + " to " + std::to_string(time),
+                   parser.seek_file(vcdpath, index, time),
+                   trace_between(full, cp ? cp->time : 0, end));
+    }
+}
+
+//! Seek through a built index, then one written out and read back.
+static void check_seek(const std::string & vcdpath) {
+    std::string indexpath = vcdpath + ".index";
+    std::string shortpath = vcdpath + ".short";
+    Trace full = plain_trace(vcdpath);
+    VCDFileParser parser;
+    VCDCheckpointIndex * built = parser.build_index(vcdpath, 5000);
+    if(check(built && built->checkpoints.size() > 1, "seek: build_index")) {
+        check_seeks("seek", vcdpath, *built, full);
+        VCDCheckpointIndex index;
+        if(check(built->write(indexpath) && index.read(indexpath),
+                 "seek: write and read")) {
+            // A cut short index is refused and changes nothing.
+            FILE * in = std::fopen(indexpath.c_str(), "rb");
+            long size = 0;
+            if(in && std::fseek(in, 0, SEEK_END) == 0)
+                size = std::ftell(in);
+            if(in)
+                std::fclose(in);
+            bool refused = size > 0;
+            for(int i = 0; i < 20 && refused; i++)
+                refused = copy_prefix(indexpath, shortpath,
+                                      random_below(size)) &&
+                          !index.read(shortpath);
+            check(refused && index.checkpoints.size() ==
+                             built->checkpoints.size(),
+                  "seek: short index refused");
+            check_seeks("seek read", vcdpath, index, full);
+        }
+    }
+    delete built;
+    unlink(indexpath.c_str());
+    unlink(shortpath.c_str());
+}
+
+/*!
+@brief Windowed parses give the full parse cut to the window.
+@details Windows start on timestamps and between them, and the last one
+runs past the end of the file.
+*/
+static void check_window(const std::string & vcdpath) {
+    Trace       full   = plain_trace(vcdpath);
+    std::string gzpath = vcdpath + ".gz";
+    if(!check(!full.times.empty() && compress_copy(vcdpath, gzpath, false),
+              "window: compress")) {
+        unlink(gzpath.c_str());
+        return;
+    }
+    VCDTime last = full.times.back();
+    for(int i = 0; i < 6; i++) {
+        VCDTime begin = i % 2 ? full.times[random_below(full.times.size())] :
+                                random_below(last);
+        VCDTime end   = i == 5 ? std::numeric_limits<VCDTime>::max() :
+                                 begin + random_below(last / 4);
+        Trace   expected = trace_between(full, begin, end);
+        std::string what = "window " + std::to_string(begin) + " to " +
+                           std::to_string(end);
+        for(int input = 0; input < 3; input++) {
+            VCDFileParser parser;
+            parser.use_mmap     = input != 1;
+            parser.window_begin = begin;
+            parser.window_end   = end;
+            check_parse(what + (input == 1 ? " unmapped" :
+                                input == 2 ? " gzip" : ""),
+                        parser, input == 2 ? gzpath : vcdpath, expected);
+        }
+    }
+    unlink(gzpath.c_str());
+}
+
+//! Run check and print its name and outcome.
+static void run(const char * name, void (*fn)(const std::string &),
+                const std::string & vcdpath) {
+    unsigned before = failures;
+    fn(vcdpath);
+    std::printf("%s: %s\n", name, failures > before ? "FAIL" : "ok");
+}
+
+int main(int argc, char ** argv) {
+    uint64_t seed = 1;
+    for(int i = 1; i < argc; i++) {
+        if(std::strncmp(argv[i], "--seed=", 7) == 0) {
+            seed = std::strtoull(argv[i] + 7, nullptr, 10);
+        } else {
+            std::fprintf(stderr, "usage: %s [--seed=N]\n", argv[0]);
+            return 2;
+        }
+    }
+    rng.seed(seed);
+
+    const char * tmpdir = std::getenv("TMPDIR");
+    std::string  vcdpath = std::string(tmpdir ? tmpdir : "/tmp") +
+                           "/vcd-check-XXXXXX";
+    int fd = mkstemp(&vcdpath[0]);
+    if(fd >= 0)
+        close(fd);
+    if(!check(fd >= 0 && write_vcd(vcdpath, 4000), "write " + vcdpath)) {
+        if(fd >= 0)
+            unlink(vcdpath.c_str());
+        return 1;
+    }
+
+    run("unmapped", check_unmapped, vcdpath);
+    run("threads", check_threads, vcdpath);
+    run("compressed", check_compressed, vcdpath);
+    run("filter", check_filter, vcdpath);
+    run("seek", check_seek, vcdpath);
+    run("window", check_window, vcdpath);
+    run("history", check_histories, vcdpath);
+    run("query", check_query, vcdpath);
+    // The cache check appends to the file, so it comes last.
+    run("cache", check_cache, vcdpath);
+    unlink(vcdpath.c_str());
+    return failures ? 1 : 0;
+}